@@ -0,0 +1,83 @@
+#ifndef BOSON_BLOCKING_H_
+#define BOSON_BLOCKING_H_
+#pragma once
+
+#include <exception>
+#include <memory>
+#include <type_traits>
+#include "engine.h"
+#include "semaphore.h"
+#include "syscalls.h"
+
+namespace boson {
+
+namespace internal {
+template <class Result>
+struct blocking_result {
+  std::unique_ptr<Result> value;
+
+  template <class Function>
+  void run(Function& function) {
+    value.reset(new Result(function()));
+  }
+
+  Result get() {
+    return std::move(*value);
+  }
+};
+
+template <>
+struct blocking_result<void> {
+  template <class Function>
+  void run(Function& function) {
+    function();
+  }
+
+  void get() {
+  }
+};
+}  // namespace internal
+
+/**
+ * Runs a blocking call without blocking the thread
+ *
+ * The routine is suspended while the function runs in the engine blocking
+ * pool, then resumed with its result. Exceptions are forwarded to the
+ * caller. Meant for regular file I/O, name resolution or blocking client
+ * libraries. The function must not use boson routine features.
+ */
+template <class Function>
+auto blocking(Function&& function) -> std::decay_t<decltype(function())> {
+  using namespace std::chrono;
+  using result_t = std::decay_t<decltype(function())>;
+  internal::blocking_result<result_t> result;
+  std::exception_ptr error;
+  auto done = std::make_shared<semaphore>(0);
+
+  auto call = [&function, &result, &error]() {
+    try {
+      result.run(function);
+    } catch (...) {
+      error = std::current_exception();
+    }
+  };
+  while (!internal::current_thread()->submit_blocking(call, [done]() { done->post(); })) {
+    // Queue is full, let the pool catch up
+    boson::sleep(milliseconds(1));
+  }
+  done->wait();
+
+  if (error) std::rethrow_exception(error);
+  return result.get();
+}
+
+/**
+ * Returns the figures of the blocking pool of the current engine
+ */
+inline blocking_pool_stats blocking_stats() {
+  return internal::current_thread()->get_engine().blocking_stats();
+}
+
+}  // namespace boson
+
+#endif  // BOSON_BLOCKING_H_
@@ -32,6 +32,7 @@ class channel_impl {
   friend class event_channel_read_storage;
   template <class Content, std::size_t InSize, class Func>
   friend class event_channel_write_storage;
+  friend class internal::task_access;
 
   std::array<ContentType, Size> buffer_;
   std::atomic<size_t> head_;
@@ -107,6 +108,7 @@ class channel_impl<std::nullptr_t,Size> {
   friend class event_channel_read_storage;
   template <class Content, std::size_t InSize, class Func>
   friend class event_channel_write_storage;
+  friend class internal::task_access;
 
   using ContentType = std::nullptr_t;
 
@@ -173,6 +175,7 @@ class channel {
   friend class event_channel_read_storage;
   template <class Content, std::size_t InSize, class Func>
   friend class event_channel_write_storage;
+  friend class internal::task_access;
   using value_t = ContentType;
   using impl_t = channel_impl<value_t, Size>;
 
@@ -3,14 +3,17 @@
 #pragma once
 
 #include <atomic>
-#include <condition_variable>
+#include <chrono>
 #include <future>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <tuple>
 #include <vector>
+#include "internal/blocking_pool.h"
 #include "internal/routine.h"
 #include "internal/thread.h"
+#include "engine_options.h"
 #include "external/json_backbone.hpp"
 #include "queues/lcrq.h"
 #include "queues/mpsc.h"
@@ -34,17 +37,36 @@ class engine : public event_handler {
   struct thread_view {
     thread_t thread;
     std::thread std_thread;
-    size_t nb_routines = 0;
-    bool sent_end_request = false;
+    // Routines sent to the thread, by the engine or directly by other threads
+    std::atomic<size_t> nb_sent_routines{0};
+    // Routines received by the thread when it last went idle
+    std::atomic<size_t> nb_reported_routines{0};
+    std::atomic<bool> hungry{false};
+
+    // Published by the thread itself for load aware placement
+    std::atomic<size_t> load{0};
+    std::atomic<size_t> busy_ratio{0};
+    std::atomic<size_t> nb_received_routines{0};
+    // NUMA node of the thread, -1 until known
+    std::atomic<int> numa_node{-1};
+
+    // Set once the thread runs, always true unless the engine is elastic
+    std::atomic<bool> started{false};
+    std::atomic<size_t> nb_runnable{0};
+    // steady_clock time since which the thread has no routine, 0 if it has some
+    std::atomic<int64_t> idle_since{0};
 
     inline thread_view(engine& engine) : thread{engine} {
     }
   };
 
-  enum class command_type { add_routine, notify_idle, notify_end_of_thread, fd_panic };
+  enum class command_type { add_routine, add_routines, fd_panic };
 
-  using command_new_routine_data = std::tuple<thread_id, std::unique_ptr<internal::routine>>;
-  using command_data = json_backbone::variant<std::nullptr_t, int, size_t, command_new_routine_data>;
+  using command_new_routine_data =
+      std::tuple<thread_id, placement, std::unique_ptr<internal::routine>>;
+  using command_new_routines_data = std::tuple<placement, internal::run_queue>;
+  using command_data = json_backbone::variant<std::nullptr_t, int, size_t, command_new_routine_data,
+                                              command_new_routines_data>;
 
   struct command {
     thread_id from;
@@ -60,12 +82,17 @@ class engine : public event_handler {
 
   friend class internal::engine_proxy;
 
-  std::size_t nb_active_threads_;
+  std::atomic<std::size_t> nb_active_threads_;
   thread_list_t threads_;
   size_t max_nb_cores_;
+  engine_options options_;
   std::atomic<thread_id> current_thread_id_{0};
+  // Routine ids are given to threads by blocks
   std::atomic<routine_id> current_routine_id_{0};
 
+  // Number of threads asking for routines when work stealing is enabled
+  std::atomic<int> nb_hungry_threads_{0};
+
   // This is used to add routines from the external main thread
   //
   // Should not be used a lot.
@@ -82,22 +109,89 @@ class engine : public event_handler {
    */
   thread_id register_thread_id();
 
+  /**
+   * Chooses a thread for a routine given without explicit target
+   */
+  thread_id place(placement policy, thread_id from);
+
+  /**
+   * Returns the thread with the lowest load
+   *
+   * The load counts queued and suspended routines, routines sent but not
+   * yet received, and is weighted by the recent busy time of the thread.
+   * Threads on another NUMA node than the requester weight twice as much.
+   */
+  thread_id least_loaded_thread(thread_id from) const;
+
+  // Tells if both threads are known to be on different NUMA nodes
+  bool is_remote(thread_id first, thread_id second) const;
+
+  /**
+   * Starts the given thread unless it already runs
+   *
+   * May be called from any thread. Commands can only be pushed to a
+   * started thread.
+   */
+  void start_thread(thread_id id);
+
+  // Current steady_clock time, as published in idle_since
+  static inline int64_t steady_now();
+
+  // Tells if placement may choose the thread: started and not parked
+  bool is_available(thread_id id, int64_t now) const;
+
+  /**
+   * Gives an elastic engine the chance to grow
+   *
+   * Returns target if it is not overloaded, otherwise a parked thread or
+   * a newly started one if any.
+   */
+  thread_id grow(thread_id target);
+
   //using queue_t = queues::lcrq;
   using queue_t = queues::mpsc<std::unique_ptr<command>>;
   queue_t command_queue_;
-  std::condition_variable command_waiter_;
-  //event_loop command_loop_;
-  //int self_event_id_;
-  std::atomic<size_t> command_pushers_;
 
+  /**
+   * Supervisor wake up
+   *
+   * Threads publish their idle and termination states in atomics and only
+   * write in this eventfd if the supervisor has not been woken up already.
+   */
+  int wakeup_fd_;
+  std::atomic<bool> wakeup_pending_{false};
+
+  // Runs calls given to boson::blocking
+  internal::blocking_pool blocking_pool_;
+
+  // Serializes thread starts
+  std::mutex start_lock_;
+  std::atomic<size_t> nb_started_threads_{0};
+
+  void wake_up();
   void push_command(thread_id from, std::unique_ptr<command> new_command);
-  void execute_commands();
+
+  /**
+   * Sends a batch of routines by chunks
+   *
+   * The batch is split evenly over the available threads, each chunk
+   * goes to the thread the policy chooses in a single thread command.
+   */
+  void dispatch_batch(thread_id from, placement policy, internal::run_queue batch);
+
+  // Returns true if at least one command has been executed
+  bool execute_commands();
+
+  // Returns true if every thread is idle and every sent routine has been received
+  bool is_quiescent(std::vector<size_t> const& reported_routines) const;
   void wait_all_routines();
 
  public:
-  engine(size_t max_nb_cores);
+  engine(size_t max_nb_cores, engine_options options = {});
   template <class Function, class... Args>
   engine(size_t max_nb_cores, Function&& start_func, Args&&... args);
+  template <class Function, class... Args>
+  engine(size_t max_nb_cores, engine_options options, Function&& start_func, Args&&... args);
   engine(engine const&) = delete;
   engine(engine&&) = default;
   engine& operator=(engine const&) = delete;
@@ -109,6 +203,20 @@ class engine : public event_handler {
   void write(int fd, void* data, event_status status) override;
 
   inline size_t max_nb_cores() const;
+  inline engine_options const& options() const;
+  inline blocking_pool_stats blocking_stats() const;
+
+  // Sums the stack cache figures of every thread
+  stack_cache_stats stack_stats() const;
+
+  // Merges the stack usage measured by every thread
+  stack_usage_profile stack_profile() const;
+
+  // Number of threads running, lower than max_nb_cores if elastic
+  inline size_t nb_started_threads() const;
+
+  // Tells if the thread runs, always true unless the engine is elastic
+  inline bool is_started(thread_id id) const;
 
   /***
    * Starts a routine into the given thread
@@ -121,6 +229,12 @@ class engine : public event_handler {
    */
   template <class Function, class... Args>
   void start(Function&& function, Args&&... args);
+
+  /**
+   * Starts a routine in a thread chosen by the given policy
+   */
+  template <class Function, class... Args>
+  void start(placement policy, Function&& function, Args&&... args);
 };
 
 // Inline/template implementations
@@ -128,21 +242,64 @@ inline size_t engine::max_nb_cores() const {
   return max_nb_cores_;
 }
 
+inline engine_options const& engine::options() const {
+  return options_;
+}
+
+inline blocking_pool_stats engine::blocking_stats() const {
+  return blocking_pool_.stats();
+}
+
+inline int64_t engine::steady_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+inline size_t engine::nb_started_threads() const {
+  return nb_started_threads_.load(std::memory_order_acquire);
+}
+
+inline bool engine::is_started(thread_id id) const {
+  return threads_.at(id)->started.load(std::memory_order_acquire);
+}
+
 template <class Function, class... Args>
 engine::engine(size_t max_nb_cores, Function&& function, Args&&... args) : engine(max_nb_cores) {
   // Launch init routine
   start(max_nb_cores_, std::forward<Function>(function), std::forward<Args>(args)...);
 };
 
+template <class Function, class... Args>
+engine::engine(size_t max_nb_cores, engine_options options, Function&& function, Args&&... args)
+    : engine(max_nb_cores, std::move(options)) {
+  // Launch init routine
+  start(max_nb_cores_, std::forward<Function>(function), std::forward<Args>(args)...);
+};
+
 template <class Function, class... Args>
 void engine::start(thread_id id, Function&& function, Args&&... args) {
+  auto new_routine = std::make_unique<internal::routine>(
+      current_routine_id_++, std::forward<Function>(function), std::forward<Args>(args)...);
+  // A routine explicitly placed must stay in its thread
+  if (id != max_nb_cores_) new_routine->pin();
   // Send a request
   push_command(max_nb_cores_, std::make_unique<command>(
                                   max_nb_cores_, command_type::add_routine,
-                                  command_new_routine_data{id, std::make_unique<internal::routine>(
-                                                                   current_routine_id_++,
-                                                                   std::forward<Function>(function),
-                                                                   std::forward<Args>(args)...)}));
+                                  command_new_routine_data{id, options_.default_placement,
+                                                           std::move(new_routine)}));
+};
+
+template <class Function, class... Args>
+void engine::start(placement policy, Function&& function, Args&&... args) {
+  push_command(max_nb_cores_,
+               std::make_unique<command>(
+                   max_nb_cores_, command_type::add_routine,
+                   command_new_routine_data{
+                       max_nb_cores_, policy,
+                       std::make_unique<internal::routine>(current_routine_id_++,
+                                                           std::forward<Function>(function),
+                                                           std::forward<Args>(args)...)}));
 };
 
 template <class Function, class... Args>
@@ -155,6 +312,30 @@ inline void run(size_t max_nb_cores, Function&& start_func, Args&&... args) {
   engine{max_nb_cores, std::forward<Function>(start_func), std::forward<Args>(args)...};
 }
 
+template <class Function, class... Args>
+inline void run(size_t max_nb_cores, engine_options options, Function&& start_func,
+                Args&&... args) {
+  engine{max_nb_cores, std::move(options), std::forward<Function>(start_func),
+         std::forward<Args>(args)...};
+}
+
+/**
+ * Returns the stack cache figures of the current engine
+ */
+inline stack_cache_stats stack_stats() {
+  return internal::current_thread()->get_engine().stack_stats();
+}
+
+/**
+ * Returns the stack usage per function type of the current engine
+ *
+ * Empty unless the engine profiles stacks. Keys are the typeid of the
+ * functions given to start.
+ */
+inline stack_usage_profile stack_profile() {
+  return internal::current_thread()->get_engine().stack_profile();
+}
+
 }  // namespace boson
 
 #endif  // BOSON_ENGINE_H_
@@ -0,0 +1,280 @@
+#ifndef BOSON_ENGINE_OPTIONS_H_
+#define BOSON_ENGINE_OPTIONS_H_
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace boson {
+
+/**
+ * Policies used to choose the thread of a new routine
+ */
+enum class placement {
+  round_robin,   // Threads are used in turn
+  least_loaded,  // Thread with the fewest routines and the least recent busy time
+  local          // Thread of the routine calling start, if any
+};
+
+/**
+ * Policies used to order the routines a thread runs
+ */
+enum class scheduling {
+  fifo,              // Routines run in the order they became runnable
+  priority,          // Routines of a more urgent class run first, others wait
+  earliest_deadline  // Routines with the closest deadline run first
+};
+
+/**
+ * Urgency classes of routines, from the most to the least urgent
+ */
+enum class priority_class { critical, normal, background };
+
+/**
+ * Stack sizes a routine may be started with
+ */
+enum class stack_class {
+  tiny,    // 4 KiB, for routines doing little more than waiting
+  small,   // 8 KiB, the historic size
+  medium,  // 64 KiB
+  large    // 1 MiB, for deep recursions
+};
+
+static constexpr std::size_t nb_stack_classes = 4;
+
+/**
+ * Memory routine stacks are mapped from
+ */
+enum class stack_memory {
+  regular,    // One anonymous mapping per stack
+  huge_pages  // Stacks carved from 2 MiB arenas backed by transparent huge pages
+};
+
+/**
+ * start_options gives attributes to a new routine
+ *
+ * Priority and deadline are ignored by the fifo scheduling.
+ */
+struct start_options {
+  using time_point = std::chrono::steady_clock::time_point;
+
+  priority_class priority = priority_class::normal;
+
+  // Routines without deadline run after those having one
+  time_point deadline = time_point::max();
+
+  stack_class stack = stack_class::small;
+
+  /**
+   * Runs the routine on the stack shared by its thread
+   *
+   * When another routine needs that stack, the used part of this one is
+   * copied to a heap buffer sized to it, and copied back when it resumes.
+   * Suspended routines then hold a few hundred bytes instead of a stack,
+   * at the cost of copies. Such routines stay in their thread, and must
+   * not give the address of their locals to other routines.
+   */
+  bool shared_stack = false;
+};
+
+/**
+ * engine_options gathers the tunables of an engine instance
+ *
+ * Default values reproduce the historic behavior of the engine, so
+ * an engine built without options behaves as it always did.
+ */
+struct engine_options {
+  /**
+   * Lets idle threads take runnable routines from busy threads
+   *
+   * Only routines that are new or yielding may change thread. Routines
+   * suspended on events stay where their events are registered, and
+   * routines started with an explicit thread id never move.
+   */
+  bool work_stealing = false;
+
+  /**
+   * Placement used by start when no hint is given
+   */
+  placement default_placement = placement::round_robin;
+
+  /**
+   * Capacity of the rings carrying commands between two threads
+   *
+   * Each thread gets a bounded ring per sender, so cross thread wake ups
+   * and routine hand overs no longer allocate. Commands overflowing a
+   * ring go through the unbounded queue. Memory grows with the square of
+   * the number of threads. Zero keeps the unbounded queue only.
+   */
+  size_t command_ring_capacity = 0;
+
+  /**
+   * CPUs the engine threads are pinned to
+   *
+   * Thread i is pinned to cpu_affinity[i % cpu_affinity.size()]. Empty
+   * leaves threads free to run anywhere.
+   */
+  std::vector<int> cpu_affinity;
+
+  /**
+   * Makes each thread allocate its memory on its own NUMA node
+   *
+   * Covers routine stacks, the event loop and command rings of the thread,
+   * and every structure it grows once started. Best used with
+   * cpu_affinity, otherwise the node is the one the thread started on.
+   * Ignored if the kernel does not support NUMA.
+   */
+  bool numa_local_memory = false;
+
+  /**
+   * Policy used by threads to order their runnable routines
+   */
+  scheduling scheduling_policy = scheduling::fifo;
+
+  /**
+   * Number of rounds a less urgent routine may be passed over
+   *
+   * Used by the priority scheduling: past this number of rounds, every
+   * runnable routine runs once regardless of its class.
+   */
+  size_t starvation_limit = 16;
+
+  /**
+   * Time a routine may run before maybe_yield gives control back
+   */
+  std::chrono::microseconds yield_quantum{1000};
+
+  /**
+   * Number of threads running calls given to boson::blocking
+   *
+   * They are only started by the first call. Zero disables blocking.
+   */
+  size_t blocking_pool_size = 4;
+
+  /**
+   * Number of blocking calls that may wait for a pool thread
+   *
+   * Callers finding the queue full retry after a millisecond.
+   */
+  size_t blocking_queue_depth = 1024;
+
+  /**
+   * Longest time an idle thread spins before blocking in the kernel
+   *
+   * While spinning, the thread watches its commands and polls its fds
+   * so a wake up from another thread costs neither a syscall nor a
+   * kernel scheduling round trip. The actual budget adapts between a
+   * sixteenth of this value and this value: it doubles when spinning
+   * found work, it halves when the thread had to block anyway.
+   * Zero disables spinning.
+   */
+  std::chrono::microseconds spin_before_park{0};
+
+  /**
+   * Idle threads spin until they have work and never block
+   *
+   * Each thread then burns a core, for deployments that can afford it.
+   */
+  bool busy_poll = false;
+
+  /**
+   * Starts threads on demand instead of all at once
+   *
+   * Only min_nb_threads threads start with the engine. Another one starts
+   * when placing a routine finds more than elastic_start_threshold
+   * routines runnable or on their way on the chosen thread, or when a
+   * routine is explicitly started on it. A thread beyond the minimum that
+   * has been without routine for park_after is parked: placement skips
+   * it, and it sleeps in the kernel until placement needs it again.
+   */
+  bool elastic = false;
+  std::size_t min_nb_threads = 1;
+  std::size_t elastic_start_threshold = 4;
+  std::chrono::milliseconds park_after{100};
+
+  /**
+   * Number of stacks each thread keeps for its new routines
+   *
+   * Routines get their stack when they first run, from the cache of their
+   * thread, and give it back when they end. Zero maps and unmaps a stack
+   * per routine.
+   */
+  std::size_t stack_cache_size = 0;
+
+  /**
+   * Number of cached stacks a thread keeps in memory
+   *
+   * Stacks cached beyond it keep their mapping but their memory is given
+   * back to the kernel, which bounds the memory held by an idle thread.
+   */
+  std::size_t stack_cache_high_water_mark = 16;
+
+  /**
+   * Stack classes whose stacks get a guard page, indexed by stack_class
+   *
+   * An overflow then faults right away instead of silently corrupting
+   * the memory below, at the cost of one more page of address space.
+   * Each class has its own cache of stack_cache_size stacks. Guards are
+   * ignored with huge page backing, since they would split the arenas.
+   */
+  std::array<bool, nb_stack_classes> stack_guards{{false, false, true, true}};
+
+  /**
+   * Measures how much stack routines really use
+   *
+   * Stacks are painted with a canary pattern when given to a routine, and
+   * the untouched part is measured when it finishes. Figures are kept per
+   * function type, see boson::stack_profile(). Painting faults in every
+   * page of the stack, so this is meant for sizing runs.
+   */
+  bool stack_profiling = false;
+
+  /**
+   * Picks the stack class of new routines from their profile
+   *
+   * Implies stack_profiling. Routines started with the default class get
+   * the smallest guarded class fitting the usage seen so far for their
+   * function type, with a half margin, once it has been sampled
+   * stack_sizing_samples times. That usage is only a lower bound, so
+   * routines never shrink into an unguarded class, see stack_guards.
+   */
+  bool auto_stack_sizing = false;
+  std::size_t stack_sizing_samples = 8;
+
+  /**
+   * Backing of the routine stacks
+   *
+   * Huge page arenas put many stacks behind a single TLB entry, which
+   * helps when thousands of routines are switched between. Their stacks
+   * get no guard page. Stacks taken back by the kernel split the huge
+   * pages of their arena, so huge pages need a non zero stack_cache_size,
+   * otherwise each finished routine unmaps its stack from the arena.
+   */
+  stack_memory stack_backing = stack_memory::regular;
+
+  /**
+   * Bytes at the top of new stacks faulted in when they are mapped
+   *
+   * A fresh routine then takes no page fault on its first frames. With
+   * stack_lock, those bytes are mlocked too, if RLIMIT_MEMLOCK allows it.
+   * They are kept when cached stacks are trimmed.
+   */
+  std::size_t stack_prefault_size = 0;
+  bool stack_lock = false;
+
+  /**
+   * Counts page faults and dTLB misses of the engine threads
+   *
+   * Uses perf events, the counters stay at 0 where they are not allowed.
+   */
+  bool stack_fault_counters = false;
+
+  // Class of the stack each thread shares between its shared stack routines
+  stack_class shared_stack_class = stack_class::large;
+};
+
+}  // namespace boson
+
+#endif  // BOSON_ENGINE_OPTIONS_H_
@@ -110,6 +110,14 @@ class event_loop;
    //* This can be useful to interrupt listening servers
    //*/
   //void send_fd_panic(int proc_from, int fd);
+//
+  ///**
+   //* Tells, without dispatching them, if events are waiting
+   //*
+   //* Unlike loop, this never blocks and leaves the events for the
+   //* next iteration
+   //*/
+  //bool has_pending_events();
 //
   ///**
    //* Executes the event loop
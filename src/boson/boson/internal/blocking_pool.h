@@ -0,0 +1,79 @@
+#ifndef BOSON_BLOCKING_POOL_H_
+#define BOSON_BLOCKING_POOL_H_
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace boson {
+
+/**
+ * Figures of the pool running blocking calls
+ */
+struct blocking_pool_stats {
+  size_t nb_submitted;  // Calls accepted since the engine started
+  size_t nb_completed;  // Calls done since the engine started
+  size_t nb_rejected;   // Submissions refused because the queue was full
+  size_t nb_queued;     // Calls waiting for a worker
+  size_t nb_running;    // Calls being executed
+};
+
+namespace internal {
+
+/**
+ * blocking_pool runs calls that would block an engine thread
+ *
+ * It is a plain bounded thread pool. Workers are only started on first
+ * use, so an engine never making blocking calls does not pay for them.
+ */
+class blocking_pool {
+ public:
+  struct task_t {
+    std::function<void()> call;
+    std::function<void()> notify;  // Called once the call is accounted as completed
+  };
+
+ private:
+  size_t const nb_workers_;
+  size_t const max_queued_;
+  mutable std::mutex lock_;
+  std::condition_variable ready_;
+  std::deque<task_t> tasks_;
+  std::vector<std::thread> workers_;
+  bool stopping_{false};
+
+  std::atomic<size_t> nb_submitted_{0};
+  std::atomic<size_t> nb_completed_{0};
+  std::atomic<size_t> nb_rejected_{0};
+  std::atomic<size_t> nb_running_{0};
+
+  void work();
+
+ public:
+  blocking_pool(size_t nb_workers, size_t max_queued);
+  blocking_pool(blocking_pool const&) = delete;
+  blocking_pool& operator=(blocking_pool const&) = delete;
+  ~blocking_pool();
+
+  /**
+   * Queues a call, returns false if the queue is full
+   */
+  bool submit(task_t task);
+
+  /**
+   * Runs the queued calls and joins the workers
+   */
+  void stop();
+
+  blocking_pool_stats stats() const;
+};
+
+}  // namespace internal
+}  // namespace boson
+
+#endif  // BOSON_BLOCKING_POOL_H_
@@ -3,7 +3,12 @@
 #pragma once
 
 #include <chrono>
+#include <cstddef>
 #include <memory>
+#include <new>
+#include <type_traits>
+#include <typeindex>
+#include <typeinfo>
 #include <vector>
 #include "boson/std/experimental/apply.h"
 #include "boson/syscalls.h"
@@ -11,6 +16,7 @@
 #include "boson/memory/local_ptr.h"
 #include "fcontext.h"
 #include "stack.h"
+#include "../engine_options.h"
 #include "../event_loop.h"
 #include "../external/json_backbone.hpp"
 
@@ -26,7 +32,7 @@ class semaphore;
 namespace internal {
 class routine;
 class thread;
-class timed_routines_set;
+class run_queue;
 }
 
 using routine_ptr_t = std::unique_ptr<internal::routine>;
@@ -48,6 +54,7 @@ enum class routine_status {
   yielding,              // Routine yielded and waits to be resumed
   wait_events,           // Routine awaits some events
   sema_event_candidate,  // Special status to use the routine as a scheduled one
+  migrating,             // Routine waits to be sent to another thread
   finished               // Routine finished execution
 };
 
@@ -73,7 +80,7 @@ enum class fd_status {
 
 struct routine_timer_event_data {
   routine_time_point date;
-  timed_routines_set* neighbor_timers;
+  size_t slot_index;
 };
 
 struct routine_sema_event_data {
@@ -104,6 +111,11 @@ template <>
 struct is_small_type<boson::internal::routine_io_event> {
   constexpr static bool const value = true;
 };
+// Stored inline too, so that waiting on a semaphore does not allocate
+template <>
+struct is_small_type<boson::internal::routine_sema_event_data> {
+  constexpr static bool const value = true;
+};
 }
 
 namespace boson {
@@ -131,6 +143,7 @@ void resume_routine(transfer_t transfered_context);
 struct function_holder {
   virtual ~function_holder() = default;
   virtual void operator()() = 0;
+  virtual std::type_index type() const = 0;
 };
 
 template <class Function, class... Args>
@@ -151,13 +164,72 @@ class function_holder_impl : public function_holder {
   void operator()() override {
     return experimental::apply(func_, std::move(args_));
   }
+
+  std::type_index type() const override {
+    return typeid(Function);
+  }
 };
 
-template <class Function, class... Args>
-decltype(auto) make_unique_function_holder(Function&& func, Args&&... args) {
-  return std::unique_ptr<function_holder>(new function_holder_impl<std::decay_t<Function>, Args...>(
-      std::forward<Function>(func), std::forward<Args>(args)...));
-}
+/**
+ * Storage of the function of a routine
+ *
+ * Functions capturing a few pointers are stored inline, bigger ones on
+ * the heap. It cannot be moved, since it points into itself.
+ */
+class function_storage {
+ public:
+  static constexpr std::size_t inline_size = 48;
+
+ private:
+  std::aligned_storage_t<inline_size, alignof(std::max_align_t)> buffer_;
+  function_holder* holder_;
+
+  inline bool is_inline() const {
+    return static_cast<void const*>(holder_) == static_cast<void const*>(&buffer_);
+  }
+
+  template <class Holder>
+  using fits_inline =
+      std::integral_constant<bool, sizeof(Holder) <= inline_size &&
+                                       alignof(Holder) <= alignof(std::max_align_t)>;
+
+  // Only the overload matching the holder is instantiated
+  template <class Holder, class Function, class... Args>
+  void emplace(std::true_type, Function&& func, Args&&... args) {
+    holder_ = new (&buffer_) Holder(std::forward<Function>(func), std::forward<Args>(args)...);
+  }
+
+  template <class Holder, class Function, class... Args>
+  void emplace(std::false_type, Function&& func, Args&&... args) {
+    holder_ = new Holder(std::forward<Function>(func), std::forward<Args>(args)...);
+  }
+
+ public:
+  template <class Function, class... Args>
+  function_storage(Function&& func, Args&&... args) {
+    using holder_t = function_holder_impl<std::decay_t<Function>, Args...>;
+    emplace<holder_t>(fits_inline<holder_t>{}, std::forward<Function>(func),
+                      std::forward<Args>(args)...);
+  }
+
+  function_storage(function_storage const&) = delete;
+  function_storage& operator=(function_storage const&) = delete;
+
+  ~function_storage() {
+    if (is_inline())
+      holder_->~function_holder();
+    else
+      delete holder_;
+  }
+
+  inline function_holder& operator*() const {
+    return *holder_;
+  }
+
+  inline function_holder* operator->() const {
+    return holder_;
+  }
+};
 }  // namespace detail
 
 struct in_context_function {
@@ -177,11 +249,13 @@ struct queue_request {
 class routine {
   friend void detail::resume_routine(transfer_t);
   friend void boson::yield();
+  friend bool boson::migrate_to(std::size_t);
   friend void boson::sleep(std::chrono::milliseconds);
   friend int boson::wait_readiness(fd_t,bool,int);
   template <class ContentType>
   friend class channel;
   friend class thread;
+  friend class run_queue;
   friend class boson::semaphore;
 
   struct waited_event {
@@ -189,31 +263,44 @@ class routine {
     routine_waiting_data data;
   };
 
-  std::unique_ptr<detail::function_holder> func_;
-  stack_context stack_ = allocate<default_stack_traits>();
+  detail::function_storage func_;
+  // Given by the thread on first resume
+  stack_context stack_;
   routine_status previous_status_ = routine_status::is_new;
   routine_status status_ = routine_status::is_new;
   transfer_t context_;
-  thread* thread_;
+  thread* thread_ = nullptr;
   routine_id id_;
   std::vector<waited_event> previous_events_;
   std::vector<waited_event> events_;
   routine_local_ptr_t current_ptr_;
   event_type happened_type_ = event_type::none;
   size_t happened_index_ = 0;
+  bool pinned_ = false;
+  std::size_t migration_target_ = 0;
+  start_options schedule_;
+
+  // Next routine in the run queue holding this one, if any
+  routine* next_scheduled_ = nullptr;
+
+  // Used part of the shared stack, while another routine runs on it
+  std::vector<char> saved_stack_;
+
+  // Copies the used part of the shared stack aside, or back
+  void save_shared_stack();
+  void restore_shared_stack();
 
  public:
   template <class Function, class... Args>
   routine(routine_id id, Function&& func, Args&&... args)
-      : func_{detail::make_unique_function_holder(std::forward<Function>(func),
-                                                  std::forward<Args>(args)...)},
-        id_{id} {
+      : func_{std::forward<Function>(func), std::forward<Args>(args)...}, id_{id} {
   }
 
+  // Routines live on the heap, their function may be stored inline
   routine(routine const&) = delete;
-  routine(routine&&) = default;
+  routine(routine&&) = delete;
   routine& operator=(routine const&) = delete;
-  routine& operator=(routine&&) = default;
+  routine& operator=(routine&&) = delete;
 
   ~routine();
 
@@ -226,6 +313,20 @@ class routine {
   inline routine_waiting_data& waiting_data();
   inline routine_waiting_data const& waiting_data() const;
 
+  /**
+   * Pinned routines never leave the thread they have been started in
+   */
+  inline bool is_pinned() const;
+  inline void pin();
+
+  /**
+   * Scheduling attributes used by the thread policy
+   */
+  inline start_options const& schedule() const;
+  inline void set_schedule(start_options const& options);
+
+  // Type of the function run by the routine, used to profile stacks
+  inline std::type_index function_type() const;
 
   // Clean up previous events and prepare routine to new set
   void start_event_round();
@@ -291,6 +392,28 @@ routine_status routine::status() const {
   return status_;
 }
 
+bool routine::is_pinned() const {
+  return pinned_;
+}
+
+void routine::pin() {
+  pinned_ = true;
+}
+
+start_options const& routine::schedule() const {
+  return schedule_;
+}
+
+void routine::set_schedule(start_options const& options) {
+  schedule_ = options;
+  // A saved shared stack only makes sense in its thread
+  if (schedule_.shared_stack) pinned_ = true;
+}
+
+std::type_index routine::function_type() const {
+  return func_->type();
+}
+
 size_t routine::happened_index() const {
     return happened_index_;
 }
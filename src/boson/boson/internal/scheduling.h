@@ -0,0 +1,226 @@
+#ifndef BOSON_SCHEDULING_H_
+#define BOSON_SCHEDULING_H_
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include "routine.h"
+
+namespace boson {
+namespace internal {
+
+/**
+ * Stackless task to resume, see boson/task.h
+ *
+ * Kept as a plain function and frame so that the runtime itself does
+ * not depend on C++20.
+ */
+struct task_continuation {
+  void (*resume)(void*);
+  void* frame;
+};
+
+/**
+ * Waiter of an event, either a routine or a task
+ */
+struct routine_slot {
+  routine_local_ptr_t ptr;
+  std::size_t event_index;
+  task_continuation task{nullptr, nullptr};
+};
+
+/**
+ * run_queue is an intrusive fifo of runnable routines
+ *
+ * Links live in the routines themselves, so queuing never allocates and
+ * a yield round trip only touches the routine and the queue ends. The
+ * queue owns the routines it holds.
+ */
+class run_queue {
+  routine* head_{nullptr};
+  routine* tail_{nullptr};
+  std::size_t size_{0};
+
+ public:
+  run_queue() = default;
+  run_queue(run_queue const&) = delete;
+  run_queue(run_queue&& other);
+  run_queue& operator=(run_queue const&) = delete;
+  run_queue& operator=(run_queue&& other);
+  ~run_queue();
+
+  inline bool empty() const;
+  inline std::size_t size() const;
+  inline routine* front() const;
+
+  // Takes ownership of the routine
+  inline void push_back(routine* new_routine);
+  inline void push_front(routine* new_routine);
+
+  // Gives back ownership of the first routine, the queue must not be empty
+  inline routine* pop_front();
+
+  // Moves every routine of other at the back of this queue
+  void splice_back(run_queue& other);
+
+  // Moves every routine of other at the front of this queue
+  void splice_front(run_queue& other);
+
+  void swap(run_queue& other);
+
+  // Moves the first count routines, or all of them, into a new queue
+  run_queue split_front(std::size_t count);
+
+  // Gives up the routines, still linked from the returned first one
+  routine* release();
+
+  // Takes ownership of the routines linked from first, at the back
+  void adopt(routine* first);
+
+  /**
+   * Sorts the queue, routines comparing equal keep their order
+   *
+   * Merge sort on the links, nothing is allocated.
+   */
+  template <class Compare>
+  void stable_sort(Compare&& compare);
+};
+
+/**
+ * scheduling_policy orders the run queue of a thread
+ *
+ * A thread runs its routines by rounds. Before each round, the policy
+ * orders the round and may postpone some routines to the next one.
+ */
+class scheduling_policy {
+ public:
+  virtual ~scheduling_policy() = default;
+
+  /**
+   * Orders the round and moves postponed routines into next_round
+   */
+  virtual void prepare_round(run_queue& round, run_queue& next_round) = 0;
+};
+
+/**
+ * Runs the most urgent class present, postpones the others
+ *
+ * Postponed classes run anyway once starvation_limit rounds passed
+ */
+class priority_scheduling : public scheduling_policy {
+  size_t starvation_limit_;
+  size_t nb_postponed_rounds_{0};
+
+ public:
+  priority_scheduling(size_t starvation_limit);
+  void prepare_round(run_queue& round, run_queue& next_round) override;
+};
+
+/**
+ * Runs routines by increasing deadline
+ */
+class deadline_scheduling : public scheduling_policy {
+ public:
+  void prepare_round(run_queue& round, run_queue& next_round) override;
+};
+
+/**
+ * Creates the policy asked for, nullptr meaning plain fifo
+ */
+std::unique_ptr<scheduling_policy> make_scheduling_policy(engine_options const& options);
+
+// Inline/template implementations
+bool run_queue::empty() const {
+  return nullptr == head_;
+}
+
+std::size_t run_queue::size() const {
+  return size_;
+}
+
+routine* run_queue::front() const {
+  return head_;
+}
+
+void run_queue::push_back(routine* new_routine) {
+  new_routine->next_scheduled_ = nullptr;
+  if (tail_)
+    tail_->next_scheduled_ = new_routine;
+  else
+    head_ = new_routine;
+  tail_ = new_routine;
+  ++size_;
+}
+
+void run_queue::push_front(routine* new_routine) {
+  new_routine->next_scheduled_ = head_;
+  head_ = new_routine;
+  if (!tail_) tail_ = new_routine;
+  ++size_;
+}
+
+routine* run_queue::pop_front() {
+  assert(head_);
+  routine* first = head_;
+  head_ = first->next_scheduled_;
+  if (!head_) tail_ = nullptr;
+  first->next_scheduled_ = nullptr;
+  --size_;
+  return first;
+}
+
+template <class Compare>
+void run_queue::stable_sort(Compare&& compare) {
+  // Bottom up merge sort of runs of width 1, 2, 4...
+  for (std::size_t width = 1; width < size_; width *= 2) {
+    routine* remaining = head_;
+    routine* merged_head = nullptr;
+    routine* merged_tail = nullptr;
+    auto append = [&](routine* current) {
+      if (merged_tail)
+        merged_tail->next_scheduled_ = current;
+      else
+        merged_head = current;
+      merged_tail = current;
+    };
+    while (remaining) {
+      // Cut the two runs to merge
+      routine* left = remaining;
+      std::size_t nb_left = 0;
+      while (remaining && nb_left < width) {
+        remaining = remaining->next_scheduled_;
+        ++nb_left;
+      }
+      routine* right = remaining;
+      std::size_t nb_right = 0;
+      while (remaining && nb_right < width) {
+        remaining = remaining->next_scheduled_;
+        ++nb_right;
+      }
+      // The left run wins ties, which keeps the sort stable
+      while (0 < nb_left || 0 < nb_right) {
+        if (0 < nb_left && (0 == nb_right || !compare(*right, *left))) {
+          routine* next = left->next_scheduled_;
+          append(left);
+          left = next;
+          --nb_left;
+        } else {
+          routine* next = right->next_scheduled_;
+          append(right);
+          right = next;
+          --nb_right;
+        }
+      }
+    }
+    merged_tail->next_scheduled_ = nullptr;
+    head_ = merged_head;
+    tail_ = merged_tail;
+  }
+}
+
+}  // namespace internal
+}  // namespace boson
+
+#endif  // BOSON_SCHEDULING_H_
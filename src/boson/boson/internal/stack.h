@@ -9,21 +9,53 @@ extern "C" {
 #include <unistd.h>
 }
 
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <cstddef>
+#include <mutex>
 #include <new>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+#include "../engine_options.h"
 
 #if defined(BOSON_USE_VALGRIND)
 #include <valgrind/valgrind.h>
 #endif
 
 namespace boson {
+
+/**
+ * Figures of the routine stack caches
+ */
+struct stack_cache_stats {
+  size_t nb_hits;     // Stacks taken from a cache
+  size_t nb_misses;   // Stacks mapped because the cache was empty
+  size_t nb_cached;   // Stacks currently cached
+  size_t nb_trimmed;  // Stacks whose memory was given back when cached
+  size_t nb_page_faults;  // Page faults of the engine threads, if counted
+  size_t nb_dtlb_misses;  // dTLB misses of the engine threads, if counted
+};
+
+/**
+ * Stack usage of a function type, measured when routines finish
+ */
+struct stack_usage {
+  size_t nb_samples;           // Routines measured
+  size_t max_used;             // Highest usage seen, in bytes
+  stack_class suggested_class; // Smallest class fitting max_used with a half margin
+};
+
+using stack_usage_profile = std::unordered_map<std::type_index, stack_usage>;
+
 namespace internal {
 
 struct stack_context {
   std::size_t size{0};
   void* sp{nullptr};
+  std::size_t guard_size{0};  // Mapped below the usable stack, if protected
+  stack_class size_class{stack_class::small};
 #if defined(BOSON_USE_VALGRIND)
   unsigned valgrind_stack_id{0};
 #endif
@@ -41,13 +73,33 @@ struct basic_stack_traits {
 // TODO: Those are unix specifics, to be defined elsewhere
 using default_stack_traits = basic_stack_traits<8 * 1024, 64 * 1024, 8 * 1024>;
 
+// Traits of the stack classes, see boson::stack_class
+template <bool Protected>
+using tiny_stack_traits = basic_stack_traits<4 * 1024, 4 * 1024, 0, Protected>;
+template <bool Protected>
+using small_stack_traits = basic_stack_traits<8 * 1024, 4 * 1024, 0, Protected>;
+template <bool Protected>
+using medium_stack_traits = basic_stack_traits<64 * 1024, 4 * 1024, 0, Protected>;
+template <bool Protected>
+using large_stack_traits = basic_stack_traits<1024 * 1024, 4 * 1024, 0, Protected>;
+
+/**
+ * Faults in the size bytes below top, locking them if asked
+ *
+ * Returns false if they could not be locked, they are faulted in anyway.
+ */
+bool prefault_stack(void* top, std::size_t size, bool lock) noexcept;
+
 template <class Traits>
 stack_context allocate() {
+  // The guard page lies below the usable stack
+  constexpr std::size_t guard_size = Traits::is_protected ? Traits::page_size : 0;
+  constexpr std::size_t mapped_size = Traits::stack_size + guard_size;
 #if defined(MAP_ANON)
-  void* vp = ::mmap(0, Traits::stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  void* vp = ::mmap(0, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
 #else
   void* vp =
-      ::mmap(0, Traits::stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      ::mmap(0, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 #endif
   if (MAP_FAILED == vp) throw std::bad_alloc();
 
@@ -62,6 +114,7 @@ stack_context allocate() {
   }
 
   if (0 < Traits::locked_size) {
+    prefault_stack(static_cast<char*>(vp) + mapped_size, Traits::locked_size, true);
   }
   //// conforming to POSIX.1-200
   //#if defined(BOOST_DISABLE_ASSERTS)
@@ -73,15 +126,113 @@ stack_context allocate() {
 
   stack_context sctx;
   sctx.size = Traits::stack_size;
-  sctx.sp = static_cast<char*>(vp) + sctx.size;
+  sctx.guard_size = guard_size;
+  sctx.sp = static_cast<char*>(vp) + mapped_size;
 #if defined(BOSON_USE_VALGRIND)
-  sctx.valgrind_stack_id = VALGRIND_STACK_REGISTER(sctx.sp, vp);
+  sctx.valgrind_stack_id =
+      VALGRIND_STACK_REGISTER(sctx.sp, static_cast<char*>(vp) + guard_size);
 #endif
   return sctx;
 };
 
+/**
+ * Allocates a stack of the given class
+ */
+stack_context allocate(stack_class size_class, bool is_protected);
+
 void deallocate(stack_context& sctx) noexcept;
 
+// Usable size of the stacks of a class
+std::size_t stack_class_size(stack_class size_class);
+
+// Smallest class holding the given usage with a half margin, large at most
+stack_class fitting_stack_class(std::size_t used);
+
+// Fills the usable stack with the canary pattern
+void paint_stack(stack_context const& sctx) noexcept;
+
+// Bytes of a painted stack overwritten since it was painted
+std::size_t used_stack_size(stack_context const& sctx) noexcept;
+
+/**
+ * stack_cache keeps the stacks of finished routines for new ones
+ *
+ * Each thread has its own cache, so reusing a stack costs neither a
+ * lock nor a syscall. Up to capacity stacks are kept per class. Those
+ * beyond the high water mark are given back to the kernel with madvise:
+ * they keep their mapping but not their memory.
+ */
+class stack_cache {
+  // One pool per stack class, its stacks are reused warm first
+  struct pool {
+    std::vector<stack_context> resident_stacks;
+    std::vector<stack_context> trimmed_stacks;
+    bool is_protected;
+    // Rest of the huge page arena stacks are carved from
+    char* arena_next = nullptr;
+    char* arena_end = nullptr;
+  };
+
+  std::array<pool, nb_stack_classes> pools_;
+  std::size_t capacity_;
+  std::size_t high_water_mark_;
+  stack_memory backing_;
+  std::size_t prefault_size_;
+  bool lock_;
+
+  // Maps a new stack as configured
+  stack_context map_stack(stack_class size_class, pool& class_pool);
+  stack_context carve_stack(stack_class size_class, pool& class_pool);
+
+  // Read by other threads for statistics
+  std::atomic<std::size_t> nb_hits_{0};
+  std::atomic<std::size_t> nb_misses_{0};
+  std::atomic<std::size_t> nb_trimmed_{0};
+  std::atomic<std::size_t> nb_cached_{0};
+
+ public:
+  explicit stack_cache(engine_options const& options);
+  stack_cache(stack_cache const&) = delete;
+  stack_cache& operator=(stack_cache const&) = delete;
+  ~stack_cache();
+
+  // Returns a cached stack of the class, or a new one if none is cached
+  stack_context get(stack_class size_class);
+
+  // Takes back a stack, unmapped if the cache is full
+  void put(stack_context& sctx) noexcept;
+
+  // Adds the cache counters to the given ones
+  void add_stats(stack_cache_stats& stats) const;
+
+  // Smallest class from at_least whose stacks have a guard page, or fallback
+  stack_class guarded_class(stack_class at_least, stack_class fallback) const;
+};
+
+/**
+ * stack_profiler records the stack usage of finished routines
+ *
+ * Each thread has its own. It is only written by its thread, the lock
+ * guards the reads made by others for boson::stack_profile().
+ */
+class stack_profiler {
+  mutable std::mutex lock_;
+  stack_usage_profile profile_;
+  std::size_t min_samples_;
+
+ public:
+  explicit stack_profiler(std::size_t min_samples);
+
+  // Measures the painted stack of a finished routine
+  void record(std::type_index type, stack_context const& sctx);
+
+  // Returns the class learnt for the type, or fallback if not sampled enough
+  stack_class suggest(std::type_index type, stack_class fallback) const;
+
+  // Adds the figures of this profiler to the given ones
+  void merge_into(stack_usage_profile& profile) const;
+};
+
 }  // namespace internal
 }  // namespace boson
 
@@ -6,9 +6,11 @@
 #include <cassert>
 #include <chrono>
 #include <deque>
+#include <functional>
 #include <map>
 #include <memory>
 #include <thread>
+#include <type_traits>
 #include <vector>
 #include "boson/event_loop.h"
 #include "boson/memory/local_ptr.h"
@@ -17,7 +19,11 @@
 #include "boson/queues/simple.h"
 #include "boson/queues/lcrq.h"
 #include "boson/queues/vectorized_queue.h"
+#include "boson/queues/weakrb.h"
 #include "routine.h"
+#include "scheduling.h"
+#include "tsc.h"
+#include "../engine_options.h"
 #include "../external/json_backbone.hpp"
 
 namespace json_backbone {
@@ -33,6 +39,9 @@ class engine;
 class semaphore;
 using thread_id = std::size_t;
 
+// Sender id of commands pushed from outside the engine threads
+static constexpr thread_id foreign_thread_id = static_cast<thread_id>(-1);
+
 namespace internal {
 
 enum class thread_status {
@@ -42,19 +51,84 @@ enum class thread_status {
   finished    // Thread no longer executes a routine and is not required to wait
 };
 
-enum class thread_command_type { add_routine, schedule_waiting_routine, finish, fd_panic };
+enum class thread_command_type {
+  add_routine,
+  add_routines,
+  schedule_waiting_routine,
+  finish,
+  fd_panic
+};
 
-using thread_command_data = json_backbone::variant<std::nullptr_t, int, routine_ptr_t, std::pair<std::weak_ptr<semaphore>, std::size_t>>;
-//using thread_command_data = json_backbone::variant<std::nullptr_t, int, routine_ptr_t, std::pair<semaphore*, routine*>>;
+/**
+ * Names a semaphore in a command without owning it
+ *
+ * The id tells a live semaphore from a destroyed one whose address got
+ * reused, see semaphore::pop_a_waiter.
+ */
+struct semaphore_handle {
+  semaphore* sema;
+  std::uint64_t id;
+};
 
+/**
+ * thread_command is a fixed size message sent to a thread
+ *
+ * Commands are plain data stored by value in the thread queues, so
+ * sending one does not allocate. Only the fields relevant to the type
+ * are set, the others are zero.
+ */
 struct thread_command {
   thread_command_type type;
-  thread_command_data data;
-  inline thread_command(thread_command_type new_type, thread_command_data new_data)
-      : type(new_type), data(std::move(new_data)) {
+  routine* new_routine;       // add_routine, ownership goes with the command
+                              // add_routines, first of the linked batch
+  std::size_t nb_routines;    // add_routines
+  semaphore_handle sema;      // schedule_waiting_routine
+  std::size_t slot_index;     // schedule_waiting_routine
+  int fd;                     // fd_panic
+  thread_id from;             // Set by thread::push_command
+
+  static inline thread_command make(thread_command_type type) {
+    thread_command command{};
+    command.type = type;
+    return command;
+  }
+
+  static inline thread_command add_routine(routine_ptr_t new_routine) {
+    thread_command command = make(thread_command_type::add_routine);
+    command.new_routine = new_routine.release();
+    return command;
+  }
+
+  static inline thread_command add_routines(run_queue batch) {
+    thread_command command = make(thread_command_type::add_routines);
+    command.nb_routines = batch.size();
+    command.new_routine = batch.release();
+    return command;
+  }
+
+  static inline thread_command schedule_waiting_routine(semaphore_handle sema,
+                                                        std::size_t slot_index) {
+    thread_command command = make(thread_command_type::schedule_waiting_routine);
+    command.sema = sema;
+    command.slot_index = slot_index;
+    return command;
+  }
+
+  static inline thread_command finish() {
+    return make(thread_command_type::finish);
+  }
+
+  static inline thread_command fd_panic(int fd) {
+    thread_command command = make(thread_command_type::fd_panic);
+    command.fd = fd;
+    return command;
   }
 };
 
+static_assert(std::is_trivial<thread_command>::value &&
+                  std::is_standard_layout<thread_command>::value,
+              "thread_command is copied around by the queues as plain data");
+
 /**
  * engine_proxy represents and engine view from the thread
  *
@@ -62,9 +136,14 @@ struct thread_command {
  * on the engine. currently, this semantics is an id.
  */
 class engine_proxy final {
+  // Number of routine ids reserved at once from the engine
+  static constexpr routine_id routine_id_block_size = 1024;
+
   // Use a pointer here to get free move ctor and operator
   engine* engine_;
   thread_id current_thread_id_;
+  routine_id next_routine_id_{0};
+  routine_id last_routine_id_{0};
 
  public:
   engine_proxy(engine&);
@@ -72,10 +151,55 @@ class engine_proxy final {
   void set_id();
   routine_id get_new_routine_id();
   void notify_end();
-  void notify_idle(size_t nb_suspended_routines);
+  void notify_idle(size_t nb_received_routines);
   void start_routine(std::unique_ptr<routine> new_routine);
+  void start_routine(placement policy, std::unique_ptr<routine> new_routine);
+
+  /**
+   * Sends a routine directly to the given thread
+   *
+   * The engine is not involved since there is no placement to decide.
+   */
   void start_routine(thread_id target_thread, std::unique_ptr<routine> new_routine);
+
+  /**
+   * Gives a batch of routines to the engine in a single command
+   *
+   * The engine splits it in chunks, each sent to a thread chosen by the
+   * policy.
+   */
+  void start_routines(placement policy, run_queue batch);
   void fd_panic(int fd);
+
+  /**
+   * Gives a call to the engine blocking pool
+   */
+  bool submit_blocking(std::function<void()> call, std::function<void()> notify);
+
+  /**
+   * Work stealing requests
+   *
+   * A thread with no runnable routine flags itself as hungry. Busy
+   * threads claim hungry threads and hand them part of their run queue,
+   * those of their own NUMA node first.
+   */
+  void set_hungry(bool hungry);
+  bool has_hungry_threads() const;
+  thread_id claim_hungry_thread();
+
+  /**
+   * Publishes the thread load for placement decisions
+   */
+  void publish_load(size_t nb_routines, size_t nb_runnable, size_t nb_received_routines,
+                    size_t busy_ratio);
+
+  /**
+   * Pins the thread and binds its memory as the engine options require
+   *
+   * Must be called from the thread itself.
+   */
+  void apply_affinity();
+
   inline thread_id get_id() const {
     return current_thread_id_;
   }
@@ -84,15 +208,11 @@ class engine_proxy final {
   }
 };
 
-// Holds pointers to routines waiting for a time out
-struct timed_routines_set final {
-  std::size_t nb_active = 0;
-  std::deque<std::size_t> slots;
-};
-
-struct routine_slot {
-  routine_local_ptr_t ptr;
-  std::size_t event_index;
+// A routine waiting for a time out
+struct timer_entry final {
+  routine_time_point date;
+  std::uint64_t sequence;  // Keeps timers of the same date in order
+  std::size_t slot_index;
 };
 
 /**
@@ -102,6 +222,8 @@ struct routine_slot {
 class thread : public event_handler {
   friend void detail::resume_routine(transfer_t);
   friend void boson::yield();
+  friend bool boson::maybe_yield();
+  friend bool boson::migrate_to(std::size_t);
   friend void boson::sleep(std::chrono::milliseconds);
   friend int boson::wait_readiness(fd_t,bool,int);
   friend void boson::fd_panic(int fd);
@@ -110,12 +232,42 @@ class thread : public event_handler {
   friend class routine;
 
   friend class boson::semaphore;
-  using engine_queue_t = queues::mpsc<std::unique_ptr<thread_command>>;
-  //using engine_queue_t = queues::simple_queue<std::unique_ptr<thread_command>>;
-  //using engine_queue_t = queues::vectorized_queue<std::unique_ptr<thread_command>>; // NOT THREAD SAFE !!
+  using engine_queue_t = queues::mpsc<thread_command>;
+  using command_ring_t = queues::weakrb<thread_command>;
 
   engine_proxy engine_proxy_;
-  std::deque<routine_slot> scheduled_routines_;
+
+  // Declared first so that routines destroyed with the thread can give their stack back
+  stack_cache stack_cache_;
+  stack_profiler stack_profiler_;
+  bool stack_profiling_;
+  bool auto_stack_sizing_;
+
+  // Stack of the shared stack routines, mapped on first use
+  stack_class shared_stack_class_;
+  stack_context shared_stack_;
+  // Routine whose frames are on the shared stack, if any
+  routine* shared_stack_owner_ = nullptr;
+
+  // Perf events counting the faults of this thread, -1 if not counted
+  std::atomic<int> page_faults_fd_{-1};
+  std::atomic<int> dtlb_misses_fd_{-1};
+
+  // Opens the perf events, from the std::thread they count
+  void open_fault_counters();
+
+  run_queue scheduled_routines_;
+
+  // Routines of the next round
+  run_queue next_scheduled_routines_;
+
+  /**
+   * Routines woken up by a semaphore
+   *
+   * They still have to win the semaphore ticket before being scheduled.
+   * Cleared after each use, so its memory is reused.
+   */
+  std::vector<routine_slot> semaphore_candidates_;
   thread_status status_{thread_status::idle};
 
   /**
@@ -138,18 +290,57 @@ class thread : public event_handler {
   std::unique_ptr<event_loop> loop_;
 
   engine_queue_t engine_queue_;
+
+  /**
+   * Command rings, one per sending thread
+   *
+   * Index max_nb_cores is used by the engine. Each ring has a single
+   * producer so commands cross without allocation or locked operation.
+   * A full ring falls back to engine_queue_. Empty if disabled.
+   */
+  std::vector<std::unique_ptr<command_ring_t>> command_rings_;
+
+  /**
+   * Commands of each sender waiting in engine_queue_
+   *
+   * A sender that spilled keeps using engine_queue_ until they are all
+   * executed, its ring then only holds older commands. This keeps the
+   * commands of a sender in order.
+   */
+  std::unique_ptr<std::atomic<std::size_t>[]> nb_spilled_commands_;
+
+  // Executes the commands of a ring
+  void drain_command_ring(std::size_t index);
+
   std::atomic<std::size_t> nb_pending_commands_{0};
+
+  /**
+   * Set when the engine event has been signaled and not handled yet
+   *
+   * Only the first command pushed after a drain writes in the eventfd,
+   * the others ride on the same wake up.
+   */
+  std::atomic<bool> wakeup_pending_{false};
+
+  // Set while idle and spinning, senders then skip the eventfd write
+  std::atomic<bool> spinning_{false};
+
+  std::atomic<std::size_t> nb_wakeups_sent_{0};
+  std::atomic<std::size_t> nb_wakeups_saved_{0};
+
   int engine_event_id_;
   int self_event_id_;
 
 
   /**
-   * This map stores the timers
+   * This heap stores the timers, the closest one on top
    *
    * The idea here is to avoid additional fd creation just for timers, so we can create
-   * a whole lot of them without consuming the fd limit per process
+   * a whole lot of them without consuming the fd limit per process. Canceled timers
+   * stay in the heap, with an empty slot, until they reach the top.
    */
-  std::map<routine_time_point, timed_routines_set> timed_routines_;
+  std::vector<timer_entry> timers_;
+  std::uint64_t nb_registered_timers_{0};
 
   /**
    * Stores the number of suspended routines
@@ -162,8 +353,53 @@ class thread : public event_handler {
    */
   size_t nb_suspended_routines_{0};
 
+  /**
+   * Number of routines received from the engine
+   *
+   * Sent along idle notifications so the engine knows if some routines
+   * it sent have not been seen yet.
+   */
+  size_t nb_received_routines_{0};
+
+  /**
+   * Moving average of the time ratio spent executing routines
+   *
+   * Expressed in busy_ratio_scale units
+   */
+  size_t busy_ratio_{0};
+
   memory::sparse_vector<routine_slot> suspended_slots_;
 
+  // Orders the run queue, plain fifo if null
+  std::unique_ptr<scheduling_policy> scheduling_policy_;
+
+  // Tick count when the running routine got the hand, and its quantum
+  uint64_t slice_start_{0};
+  uint64_t yield_quantum_ticks_;
+
+  // Current and longest spin durations of an idle thread
+  uint64_t spin_budget_ticks_;
+  uint64_t max_spin_budget_ticks_;
+
+  /**
+   * Commands sent by the thread to itself
+   *
+   * They are executed once the running routine is suspended, without
+   * going through the queues nor the event loop. Cleared once all
+   * executed, so its memory is reused.
+   */
+  std::vector<thread_command> local_commands_;
+
+  // Stackless tasks woken up, and those being resumed in this round
+  std::vector<task_continuation> ready_tasks_;
+  std::vector<task_continuation> running_tasks_;
+
+  // Resumes the tasks woken up until now
+  void run_ready_tasks();
+
+  // Wakes up the task waiting in the slot, if any
+  inline bool wake_task(routine_slot const& slot);
+
   /**
    * Struct to store the shared buffer
    *
@@ -183,6 +419,29 @@ class thread : public event_handler {
    * React to a request from the main scheduler
    */
   void handle_engine_event();
+  void execute_command(thread_command& command);
+  void push_local_command(thread_command command);
+  void execute_local_commands();
+
+  /**
+   * Schedules the semaphore candidates that get their ticket
+   *
+   * The others wait again for their events.
+   */
+  void resolve_semaphore_candidates();
+
+  /**
+   * Signals the engine event unless a signal is already pending
+   */
+  void wake_up();
+
+  /**
+   * Spins while idle, waiting for commands or fd events
+   *
+   * Returns true if work arrived, false if the budget or the given timeout
+   * expired first. Adapts the spin budget to the outcome.
+   */
+  bool spin_for_work(int timeout_ms);
 
   /**
    * Close event handlers to free the event loop
@@ -191,9 +450,30 @@ class thread : public event_handler {
 
   inline transfer_t& context();
 
-  // Returns the set in which the routine has ben referenced
-  // used to decrement the set nb_active member when disabling the timer
-  timed_routines_set& register_timer(routine_time_point const& date, routine_slot slot);
+  // Returns the slot index, used to cancel the timer
+  std::size_t register_timer(routine_time_point const& date, routine_slot slot);
+
+  /**
+   * Cancels a timer the routine no longer waits for
+   *
+   * The slot reference is dropped right away, the timer itself is
+   * removed when it reaches the top of the heap.
+   */
+  void cancel_timer(std::size_t slot_index);
+
+  // Fires the closest timers, those sharing the date of the top one
+  void fire_timers();
+
+  // Removes canceled timers from the top of the heap
+  void clean_canceled_timers();
+
+  /**
+   * Frees a suspended slot
+   *
+   * The slot reference is dropped too: a free cell is not destroyed and
+   * would keep the routine reference block alive.
+   */
+  inline void free_slot(std::size_t slot_index);
 
   // Returns the slot index used to push in the semaphore waiters queue
   std::size_t register_semaphore_wait(routine_slot slot);
@@ -222,7 +502,47 @@ class thread : public event_handler {
    */
   void schedule(routine* routine);
 
+  /**
+   * Dispatches a new routine
+   *
+   * Routines meant for this very thread are directly scheduled, routines
+   * with an explicit target are directly sent to it, the others go through
+   * the engine placement.
+   */
+  void start_new_routine(routine_ptr_t new_routine);
+  void start_new_routine(placement policy, routine_ptr_t new_routine);
+  void start_new_routine(thread_id target_thread, routine_ptr_t new_routine);
+  void start_new_routines(placement policy, run_queue batch);
+
+  /**
+   * Tells if the running routine should let others run
+   *
+   * True once its quantum is spent and if another routine, a command, a
+   * timer or an event a suspended routine waits for may be ready.
+   * Suspended routines alone do not count, so busy-polling keeps its
+   * thread until some I/O is actually ready. Otherwise a new quantum starts.
+   */
+  bool should_yield();
+
+  /**
+   * Sends a suspended routine to another thread
+   *
+   * Everything tying the routine to this thread is released first: its
+   * share of the event slots and its stale fd registrations.
+   */
+  void migrate(routine_ptr_t migrating, thread_id target_thread);
+
+  /**
+   * Gives part of the run queue to a hungry thread
+   *
+   * Only new and yielding routines are given, since they do not
+   * depend on this thread event loop.
+   */
+  void share_scheduled_routines();
+
  public:
+  static constexpr size_t busy_ratio_scale = 1024;
+
   thread(engine& parent_engine);
   thread(thread const&) = delete;
   thread(thread&&) = default;
@@ -230,22 +550,89 @@ class thread : public event_handler {
   thread& operator=(thread&&) = default;
   ~thread();
 
+  /**
+   * Pins the thread, then creates the event loop and the command rings
+   *
+   * Called by the thread itself before loop(), so that its structures
+   * are first touched on its NUMA node. The engine waits for it before
+   * sending commands. Threads an elastic engine never starts cost
+   * neither fds nor rings.
+   */
+  void prepare();
+
   inline thread_id id() const;
   inline engine const& get_engine() const;
 
+  // Placement of the routines started without one
+  placement default_placement() const;
+
   // Event handler interface
   void event(int event_id, void* data, event_status status) override;
   void read(int fd, void* data, event_status status) override;
   void write(int fd, void* data, event_status status) override;
 
-  // called by engine
-  void push_command(thread_id from, std::unique_ptr<thread_command> command);
+  // called by engine and by other threads, from must be the calling thread id
+  // or foreign_thread_id
+  void push_command(thread_id from, thread_command command);
+
+  /**
+   * Runs a call in the engine blocking pool
+   *
+   * Returns false if the pool queue is full. See boson::blocking.
+   */
+  bool submit_blocking(std::function<void()> call, std::function<void()> notify);
 
   // called by engine
   // void execute_commands();
 
   bool execute_scheduled_routines();
 
+  /**
+   * Wake up statistics
+   *
+   * Counts the eventfd writes made to signal commands to this thread, and
+   * the ones avoided because a signal was already pending.
+   */
+  inline size_t nb_wakeups_sent() const;
+  inline size_t nb_wakeups_saved() const;
+
+  // Adds the figures of the thread stack cache to the given ones
+  void add_stack_stats(stack_cache_stats& stats) const;
+
+  // Adds the stack usage measured by the thread to the given one
+  inline void add_stack_profile(stack_usage_profile& profile) const;
+
+  /**
+   * Gives a stack to a routine about to start
+   *
+   * Its class is learnt from the profile if stacks are sized
+   * automatically, and it is painted if they are profiled.
+   */
+  stack_context acquire_stack(routine const& new_routine);
+
+  // Takes back the stack of a finished routine, measuring it if profiled
+  void release_stack(routine& old_routine);
+
+  /**
+   * Gives the shared stack to a routine about to run on it
+   *
+   * The frames of the previous owner are saved first, and those of the
+   * new one restored, unless it was the last one to use it.
+   */
+  void claim_shared_stack(routine* new_owner);
+
+  /**
+   * Stackless tasks support, see boson/task.h
+   *
+   * Tasks are resumed in the thread context, between the routines of a
+   * round. Each registration resumes the task once.
+   */
+  inline void schedule_task(task_continuation task);
+  inline void register_task_timer(routine_time_point const& date, task_continuation task);
+  inline void register_task_read(int fd, task_continuation task);
+  inline void register_task_write(int fd, task_continuation task);
+  inline std::size_t register_task_semaphore_wait(task_continuation task);
+
   /**
    * Executes the boson::thread
    *
@@ -258,9 +645,31 @@ class thread : public event_handler {
    */
   template <class Function, class... Args>
   void start_routine(Function&& func, Args&&... args) {
-    engine_proxy_.start_routine(std::make_unique<routine>(engine_proxy_.get_new_routine_id(),
-                                                          std::forward<Function>(func),
-                                                          std::forward<Args>(args)...));
+    start_new_routine(std::make_unique<routine>(engine_proxy_.get_new_routine_id(),
+                                                std::forward<Function>(func),
+                                                std::forward<Args>(args)...));
+  }
+
+  /**
+   * Starts a new routine in a thread chosen by the given policy
+   */
+  template <class Function, class... Args>
+  void start_routine(placement policy, Function&& func, Args&&... args) {
+    start_new_routine(policy, std::make_unique<routine>(engine_proxy_.get_new_routine_id(),
+                                                        std::forward<Function>(func),
+                                                        std::forward<Args>(args)...));
+  }
+
+  /**
+   * Starts a new routine with scheduling attributes
+   */
+  template <class Function, class... Args>
+  void start_routine(start_options options, Function&& func, Args&&... args) {
+    auto new_routine = std::make_unique<routine>(engine_proxy_.get_new_routine_id(),
+                                                 std::forward<Function>(func),
+                                                 std::forward<Args>(args)...);
+    new_routine->set_schedule(options);
+    start_new_routine(std::move(new_routine));
   }
 
   /**
@@ -268,9 +677,34 @@ class thread : public event_handler {
    */
   template <class Function, class... Args>
   void start_routine_explicit(thread_id id, Function&& func, Args&&... args) {
-    engine_proxy_.start_routine(
-        id, std::make_unique<routine>(engine_proxy_.get_new_routine_id(),
-                                      std::forward<Function>(func), std::forward<Args>(args)...));
+    auto new_routine = std::make_unique<routine>(engine_proxy_.get_new_routine_id(),
+                                                 std::forward<Function>(func),
+                                                 std::forward<Args>(args)...);
+    new_routine->pin();
+    start_new_routine(id, std::move(new_routine));
+  }
+
+  /**
+   * Starts a routine per element of the range, calling function(element)
+   */
+  template <class Range, class Function>
+  void start_routines(placement policy, Range&& range, Function const& function) {
+    run_queue batch;
+    for (auto&& element : range)
+      batch.push_back(new routine(engine_proxy_.get_new_routine_id(), function, element));
+    start_new_routines(policy, std::move(batch));
+  }
+
+  /**
+   * Starts nb_routines routines running generator(index)
+   */
+  template <class Generator>
+  void start_generated_routines(placement policy, std::size_t nb_routines,
+                                Generator&& generator) {
+    run_queue batch;
+    for (std::size_t index = 0; index < nb_routines; ++index)
+      batch.push_back(new routine(engine_proxy_.get_new_routine_id(), generator(index)));
+    start_new_routines(policy, std::move(batch));
   }
 
   /**
@@ -312,20 +746,110 @@ engine const& thread::get_engine() const {
   return engine_proxy_.get_engine();
 }
 
+void thread::free_slot(std::size_t slot_index) {
+  suspended_slots_[slot_index].ptr = nullptr;
+  suspended_slots_[slot_index].task = task_continuation{nullptr, nullptr};
+  suspended_slots_.free(slot_index);
+}
+
+void thread::schedule_task(task_continuation task) {
+  ready_tasks_.push_back(task);
+}
+
+void thread::register_task_timer(routine_time_point const& date, task_continuation task) {
+  register_timer(date, routine_slot{{}, 0, task});
+}
+
+void thread::register_task_read(int fd, task_continuation task) {
+  register_read(fd, routine_slot{{}, 0, task});
+}
+
+void thread::register_task_write(int fd, task_continuation task) {
+  register_write(fd, routine_slot{{}, 0, task});
+}
+
+std::size_t thread::register_task_semaphore_wait(task_continuation task) {
+  return register_semaphore_wait(routine_slot{{}, 0, task});
+}
+
+bool thread::wake_task(routine_slot const& slot) {
+  if (!slot.task.resume) return false;
+  ready_tasks_.push_back(slot.task);
+  return true;
+}
+
+void thread::add_stack_profile(stack_usage_profile& profile) const {
+  stack_profiler_.merge_into(profile);
+}
+
+size_t thread::nb_wakeups_sent() const {
+  return nb_wakeups_sent_.load(std::memory_order_relaxed);
+}
+
+size_t thread::nb_wakeups_saved() const {
+  return nb_wakeups_saved_.load(std::memory_order_relaxed);
+}
+
 }  // namespace internal
 
+template <class Function, class... Args>
+void start(start_options options, Function&& func, Args&&... args) {
+  internal::current_thread()->start_routine(options, std::forward<Function>(func),
+                                            std::forward<Args>(args)...);
+}
+
 template <class Function, class... Args>
 void start_explicit(thread_id id, Function&& func, Args&&... args) {
   internal::current_thread()->start_routine_explicit(id, std::forward<Function>(func),
                                             std::forward<Args>(args)...);
 }
 
+/**
+ * Starts a routine per element of the range, running function(element)
+ *
+ * The whole batch is given to the engine at once, which spreads it over
+ * the threads by chunks. Elements are copied into their routine.
+ */
+template <class Range, class Function>
+void start_batch(placement policy, Range&& range, Function const& function) {
+  internal::current_thread()->start_routines(policy, std::forward<Range>(range), function);
+}
+
+template <class Range, class Function>
+void start_batch(Range&& range, Function const& function) {
+  auto this_thread = internal::current_thread();
+  this_thread->start_routines(this_thread->default_placement(),
+                              std::forward<Range>(range), function);
+}
+
+/**
+ * Starts nb_routines routines, the index-th one running generator(index)()
+ */
+template <class Generator>
+void start_batch_n(placement policy, std::size_t nb_routines, Generator&& generator) {
+  internal::current_thread()->start_generated_routines(policy, nb_routines,
+                                                       std::forward<Generator>(generator));
+}
+
+template <class Generator>
+void start_batch_n(std::size_t nb_routines, Generator&& generator) {
+  auto this_thread = internal::current_thread();
+  this_thread->start_generated_routines(this_thread->default_placement(),
+                                        nb_routines, std::forward<Generator>(generator));
+}
+
 template <class Function, class... Args>
 void start(Function&& func, Args&&... args) {
   internal::current_thread()->start_routine(std::forward<Function>(func),
                                             std::forward<Args>(args)...);
 }
 
+template <class Function, class... Args>
+void start(placement policy, Function&& func, Args&&... args) {
+  internal::current_thread()->start_routine(policy, std::forward<Function>(func),
+                                            std::forward<Args>(args)...);
+}
+
 }  // namespace boson
 
 #endif  // BOSON_THREAD_H_
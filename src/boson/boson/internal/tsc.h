@@ -0,0 +1,47 @@
+#ifndef BOSON_TSC_H_
+#define BOSON_TSC_H_
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace boson {
+namespace internal {
+
+/**
+ * Reads a cheap monotonic tick counter
+ *
+ * This is the time stamp counter on x86, a steady clock elsewhere. Ticks
+ * are only meant to be compared with each other on the same thread.
+ */
+inline uint64_t read_tsc() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+/**
+ * Hints the CPU that the thread is spinning
+ */
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#endif
+}
+
+/**
+ * Returns the number of ticks per microsecond
+ *
+ * Measured once per process against the steady clock.
+ */
+uint64_t tsc_ticks_per_microsecond();
+
+}  // namespace internal
+}  // namespace boson
+
+#endif  // BOSON_TSC_H_
@@ -1,6 +1,9 @@
 #ifndef BOSON_MEMORY_LOCAL_PTR_H_
 #define BOSON_MEMORY_LOCAL_PTR_H_
 #include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
 #include <utility>
 
 namespace boson {
@@ -20,6 +23,20 @@ class local_ptr final {
   struct references {
     std::size_t shared_refs;
     T* value;
+    // Holds the value when given by move, so that it shares the allocation
+    typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+
+    inline T* inline_value() {
+      return reinterpret_cast<T*>(&storage);
+    }
+
+    inline void destroy_value() {
+      if (value == inline_value())
+        value->~T();
+      else
+        delete value;
+      value = nullptr;
+    }
   };
 
   inline void decrement() {
@@ -27,7 +44,7 @@ class local_ptr final {
       assert(0 < ref_->shared_refs);
       --ref_->shared_refs;
       if (0 == ref_->shared_refs) {
-        delete ref_->value;
+        ref_->destroy_value();
         delete ref_;
         ref_ = nullptr;
       }
@@ -38,10 +55,11 @@ class local_ptr final {
  public:
   local_ptr() : ref_{nullptr} {
   }
-  local_ptr(T* in_value) : ref_{new references{1u, in_value}} {
+  local_ptr(T* in_value) : ref_{new references{1u, in_value, {}}} {
   }
 
-  local_ptr(T&& in_value) : ref_{new references{1u, new T{std::move(in_value)}}} {
+  local_ptr(T&& in_value) : ref_{new references{1u, nullptr, {}}} {
+    ref_->value = new (ref_->inline_value()) T{std::move(in_value)};
   }
 
   local_ptr(local_ptr const& other) : ref_{other.ref_} {
@@ -81,11 +99,27 @@ class local_ptr final {
   inline void reset(T* new_value = nullptr) {
     // Assert ref ?
     if (ref_) {
-      delete ref_->value;
+      ref_->destroy_value();
       ref_->value = new_value;
     }
   }
 
+  /**
+   * Tells if no other pointer shares the reference
+   */
+  inline bool unique() const {
+    return ref_ && 1u == ref_->shared_refs;
+  }
+
+  /**
+   * Replaces the value of a unique pointer, reusing its allocation
+   */
+  inline void emplace(T&& new_value) {
+    assert(unique());
+    ref_->destroy_value();
+    ref_->value = new (ref_->inline_value()) T{std::move(new_value)};
+  }
+
   inline void invalidate_all() {
     reset();
   }
@@ -0,0 +1,133 @@
+#ifndef BOSON_PARALLEL_H_
+#define BOSON_PARALLEL_H_
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "engine.h"
+#include "semaphore.h"
+#include "syscalls.h"
+
+namespace boson {
+
+namespace internal {
+
+/**
+ * parallel_range hands out the chunks of a parallel loop
+ *
+ * Chunks are claimed from a shared cursor, so a helper whose thread is
+ * free takes more of them than one sharing its thread with busy routines.
+ * Chunks start large and shrink down to the grain as the range runs out,
+ * which keeps the number of claims low while balancing the end of the loop.
+ */
+class parallel_range {
+  std::atomic<std::size_t> next_;
+  std::size_t end_;
+  std::size_t grain_;
+  std::size_t nb_helpers_;
+  std::mutex error_lock_;
+  std::exception_ptr error_;
+
+ public:
+  // A null grain lets the range choose one
+  parallel_range(std::size_t begin, std::size_t end, std::size_t grain, std::size_t nb_helpers);
+
+  // Claims the next chunk, returns false once the range is exhausted
+  bool claim(std::size_t& first, std::size_t& last);
+
+  // Keeps the first error and stops handing out chunks
+  void fail(std::exception_ptr error);
+
+  void rethrow_if_failed();
+};
+
+/**
+ * Runs helper(range) in a routine per started engine thread, then waits
+ *
+ * The calling routine is suspended until every helper returned. Helpers
+ * give control back between chunks, so they only take the time the other
+ * routines of their thread leave.
+ */
+template <class Helper>
+void fork_join(std::size_t begin, std::size_t end, std::size_t grain, Helper& helper) {
+  if (end <= begin) return;
+  auto const& this_engine = current_thread()->get_engine();
+  std::vector<thread_id> helper_threads;
+  for (thread_id id = 0; id < this_engine.max_nb_cores(); ++id) {
+    if (this_engine.is_started(id)) helper_threads.push_back(id);
+  }
+
+  parallel_range range{begin, end, grain, helper_threads.size()};
+  auto done = std::make_shared<semaphore>(0);
+  for (thread_id id : helper_threads) {
+    start_explicit(id, [&range, &helper, done]() {
+      try {
+        helper(range);
+      } catch (...) {
+        range.fail(std::current_exception());
+      }
+      // The range and the helper may be gone once posted
+      done->post();
+    });
+  }
+  for (std::size_t index = 0; index < helper_threads.size(); ++index) done->wait();
+  range.rethrow_if_failed();
+}
+
+}  // namespace internal
+
+/**
+ * Calls function(index) for every index of [begin, end) on every engine thread
+ *
+ * The range is split in chunks of at least grain indexes, a null grain
+ * letting boson choose. Must be called from a routine, which is suspended
+ * until the loop ends. The first exception thrown by function stops the
+ * loop and is forwarded to the caller.
+ */
+template <class Function>
+void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, Function&& function) {
+  auto helper = [&function](internal::parallel_range& range) {
+    std::size_t first = 0, last = 0;
+    while (range.claim(first, last)) {
+      for (std::size_t index = first; index < last; ++index) function(index);
+      boson::maybe_yield();
+    }
+  };
+  internal::fork_join(begin, end, grain, helper);
+}
+
+/**
+ * Reduces [begin, end) on every engine thread
+ *
+ * function(first, last, partial) folds a chunk into partial and returns
+ * it. Partial results, each starting from identity, are merged with
+ * combine(left, right), which must be associative and commutative since
+ * chunks are not merged in order. Chunking, suspension and errors are as
+ * for parallel_for.
+ */
+template <class Value, class Function, class Combine>
+Value parallel_reduce(std::size_t begin, std::size_t end, std::size_t grain, Value identity,
+                      Function&& function, Combine&& combine) {
+  Value result = identity;
+  std::mutex result_lock;
+  auto helper = [&](internal::parallel_range& range) {
+    Value partial = identity;
+    std::size_t first = 0, last = 0;
+    while (range.claim(first, last)) {
+      partial = function(first, last, std::move(partial));
+      boson::maybe_yield();
+    }
+    std::lock_guard<std::mutex> guard(result_lock);
+    result = combine(std::move(result), std::move(partial));
+  };
+  internal::fork_join(begin, end, grain, helper);
+  return result;
+}
+
+}  // namespace boson
+
+#endif  // BOSON_PARALLEL_H_
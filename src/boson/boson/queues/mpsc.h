@@ -45,7 +45,8 @@ class mpsc {
       : _head(reinterpret_cast<buffer_node_t*>(new buffer_node_aligned_t)),
         _tail(_head.load(std::memory_order_relaxed)) {
     buffer_node_t* front = _head.load(std::memory_order_relaxed);
-    ::memset(&front->data,0,sizeof(buffer_node_aligned_t));
+    // Raw storage, the data of the front node is never constructed
+    ::memset(static_cast<void*>(front), 0, sizeof(buffer_node_aligned_t));
     front->next.store(nullptr, std::memory_order_relaxed);
   }
 
@@ -172,6 +172,28 @@ class vectorized_queue {
     return true;
   }
 
+  /**
+   * Reads the first element matching the predicate
+   *
+   * Only the window first elements are looked at. Returns the rank of
+   * the element read, or window if none matched and nothing was read.
+   */
+  template <class Predicate>
+  std::size_t read_within(ValueType& value, std::size_t window, Predicate&& predicate) {
+    std::size_t index = head_;
+    for (std::size_t rank = 0; rank < window && index != empty; ++rank) {
+      assert(has(index));
+      auto& node = data_[index];
+      if (predicate(*reinterpret_cast<ValueType const*>(&node.value))) {
+        value = std::move(*reinterpret_cast<ValueType*>(&node.value));
+        free(index);
+        return rank;
+      }
+      index = node.next;
+    }
+    return window;
+  }
+
 };
 
 }  // namespace memory
@@ -24,13 +24,13 @@ class weakrb {
 
 #if defined(BOSON_USE_VALGRIND)
   // Does not work
-  static constexpr std::memory_order const order_relaxed = std::memory_order::memory_order_relaxed;
-  static constexpr std::memory_order const order_acquire = std::memory_order::memory_order_acquire;
-  static constexpr std::memory_order const order_release = std::memory_order::memory_order_release;
+  static constexpr std::memory_order const order_relaxed = std::memory_order_relaxed;
+  static constexpr std::memory_order const order_acquire = std::memory_order_acquire;
+  static constexpr std::memory_order const order_release = std::memory_order_release;
 #else
-  static constexpr std::memory_order const order_relaxed = std::memory_order::memory_order_relaxed;
-  static constexpr std::memory_order const order_acquire = std::memory_order::memory_order_acquire;
-  static constexpr std::memory_order const order_release = std::memory_order::memory_order_release;
+  static constexpr std::memory_order const order_relaxed = std::memory_order_relaxed;
+  static constexpr std::memory_order const order_acquire = std::memory_order_acquire;
+  static constexpr std::memory_order const order_release = std::memory_order_release;
 #endif
 
   index_t front_ = {0};
@@ -67,7 +67,7 @@ class weakrb {
 
   bool read(content_type& element) {
     size_t front;
-    front = front_.load(std::memory_order::memory_order_relaxed);
+    front = front_.load(std::memory_order_relaxed);
     if (cback_ - front < 1) {
       cback_ = back_.load(order_acquire);
       if (cback_ - front < 1) return false;
@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <chrono>
+#include <cstdint>
 #include <mutex>
 #include "internal/routine.h"
 #include "internal/thread.h"
@@ -11,6 +12,10 @@
 
 namespace boson {
 
+namespace internal {
+class task_access;
+}
+
 template <class ContentType, std::size_t Size, class Func>
 class event_channel_read_storage;
 template <class ContentType, std::size_t Size, class Func>
@@ -38,6 +43,7 @@ struct semaphore_result {
 class semaphore : public std::enable_shared_from_this<semaphore> {
   friend class internal::thread;
   friend class internal::routine;
+  friend class internal::task_access;
   template <class Content, std::size_t Size, class Func>
   friend class event_channel_read_storage;
   template <class Content, std::size_t Size, class Func>
@@ -46,24 +52,46 @@ class semaphore : public std::enable_shared_from_this<semaphore> {
   static constexpr int disabling_threshold = 0x40000000;
   static constexpr int disabled_standpoint = 0x60000000;
 
+  // Waiters of the posting thread are preferred if among the first ones,
+  // as long as the head of the queue has not been passed over too often
+  static constexpr std::size_t local_waiter_window = 4;
+  static constexpr std::size_t max_head_bypasses = 4;
+
   using waiting_unit_t = std::pair<internal::thread*,std::size_t>;
   using queue_t = queues::vectorized_queue<waiting_unit_t>;
   queue_t waiters_;
   std::mutex waiters_lock_;
+  std::size_t nb_head_bypasses_{0};
   std::atomic<int> counter_;
+  // Unique over the process, see internal::semaphore_handle
+  std::uint64_t id_;
 
   /**
    * tries to unlock a waiter
    *
    * this is defered to the thread maintaining said routine. so we might
-   * be suspended then unlocked right after.
+   * be suspended then unlocked right after. Waiters of the current thread
+   * are woken up without crossing threads.
    *
    * returns true if the poped thread is not the current or if
    * none could be poped
    */
   bool pop_a_waiter(internal::thread* current = nullptr);
+
+  /**
+   * Pops a waiter of the semaphore named by the handle, if it still exists
+   *
+   * Live semaphores are registered by address and id. The registry lock
+   * is held meanwhile so that the semaphore cannot be destroyed under us.
+   */
+  static void pop_a_waiter(internal::semaphore_handle handle, internal::thread* current);
+
+  inline internal::semaphore_handle handle() {
+    return {this, id_};
+  }
   size_t write(internal::thread* target, std::size_t index);
   bool read(waiting_unit_t& waiter); 
+  bool read(waiting_unit_t& waiter, internal::thread* preferred_thread);
   bool free(size_t index);
 
  public:
@@ -90,6 +118,8 @@ class semaphore : public std::enable_shared_from_this<semaphore> {
 
   /**
    * give back semaphore ticket. Always non blocking
+   *
+   * Unlike wait, post may also be called from a thread outside the engine.
    */
   semaphore_result post();
 };
@@ -105,6 +135,7 @@ semaphore_result semaphore::wait(std::chrono::milliseconds timeout) {
 class shared_semaphore {
   friend class internal::thread;
   friend class internal::routine;
+  friend class internal::task_access;
   template <class Content, std::size_t Size, class Func>
   friend class event_channel_read_storage;
   template <class Content, std::size_t Size, class Func>
@@ -20,6 +20,29 @@ static constexpr int code_panic = -101;
  */
 void yield();
 
+/**
+ * Gives back control to the scheduler if it is worth it
+ *
+ * Cheap enough to be called in tight loops. The routine only yields once
+ * it ran for the engine yield quantum, and only if another routine,
+ * an event or a timer may be waiting. Returns true if it yielded.
+ */
+bool maybe_yield();
+
+/**
+ * Moves the calling routine to another thread of the engine
+ *
+ * The routine is suspended and resumed by the target thread, where it
+ * then stays: work stealing no longer moves it. Stale fd registrations
+ * left by previous waits are dropped, the routine registers again in the
+ * target thread when it waits. A routine must not migrate while it holds
+ * a shared_buffer, which belongs to its thread.
+ *
+ * Returns false if the target thread does not exist, or if the routine
+ * runs on a shared stack.
+ */
+bool migrate_to(std::size_t target_thread);
+
 /**
  * Suspends the routine for the given duration
  */
@@ -0,0 +1,415 @@
+#ifndef BOSON_TASK_H_
+#define BOSON_TASK_H_
+#pragma once
+
+/**
+ * Stackless tasks
+ *
+ * Built on C++20 coroutines, only available when BOSON_USE_COROUTINES is
+ * defined (cmake -DBOSON_USE_COROUTINES=ON). A task costs its coroutine
+ * frame instead of a stack: it suits short lived, per message work. Code
+ * that must block deep in a call stack still needs a routine.
+ *
+ * Tasks run in the thread that started them, between the routines of a
+ * round. They must only suspend through co_await on the boson::co
+ * awaitables or on other tasks: the routine functions (boson::yield,
+ * boson::read, semaphore::wait...) must not be called from a task.
+ */
+#if defined(BOSON_USE_COROUTINES)
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include "channel.h"
+#include "semaphore.h"
+#include "internal/thread.h"
+
+namespace boson {
+
+template <class Result = void>
+class task;
+
+namespace internal {
+
+inline void resume_task_frame(void* frame) {
+  std::coroutine_handle<>::from_address(frame).resume();
+}
+
+inline task_continuation make_continuation(std::coroutine_handle<> handle) {
+  return {&resume_task_frame, handle.address()};
+}
+
+struct task_promise_base {
+  // Task awaiting this one, resumed when it ends
+  std::coroutine_handle<> continuation;
+  std::exception_ptr error;
+  // Started with start_task, nobody awaits it
+  bool detached = false;
+
+  struct final_awaiter {
+    bool await_ready() noexcept {
+      return false;
+    }
+
+    template <class Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+      auto& promise = handle.promise();
+      if (promise.detached) {
+        handle.destroy();
+        return std::noop_coroutine();
+      }
+      return promise.continuation ? promise.continuation : std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {
+    }
+  };
+
+  std::suspend_always initial_suspend() noexcept {
+    return {};
+  }
+
+  final_awaiter final_suspend() noexcept {
+    return {};
+  }
+
+  void unhandled_exception() {
+    // Like routines, detached tasks must not let an exception out
+    if (detached) std::terminate();
+    error = std::current_exception();
+  }
+};
+
+template <class Result>
+struct task_promise : task_promise_base {
+  std::optional<Result> value;
+
+  task<Result> get_return_object();
+
+  template <class Value>
+  void return_value(Value&& new_value) {
+    value.emplace(std::forward<Value>(new_value));
+  }
+
+  Result get() {
+    if (error) std::rethrow_exception(error);
+    return std::move(*value);
+  }
+};
+
+template <>
+struct task_promise<void> : task_promise_base {
+  task<void> get_return_object();
+
+  void return_void() {
+  }
+
+  void get() {
+    if (error) std::rethrow_exception(error);
+  }
+};
+
+/**
+ * Gives tasks access to the semaphore and channel internals
+ */
+class task_access {
+ public:
+  static semaphore& get(semaphore& sema) {
+    return sema;
+  }
+
+  static semaphore& get(shared_semaphore& sema) {
+    return *sema.impl_;
+  }
+
+  template <class ContentType, std::size_t Size>
+  static auto& impl(channel<ContentType, Size>& chan) {
+    return *chan.channel_;
+  }
+
+  template <class ContentType, std::size_t Size>
+  static thread_id id(channel<ContentType, Size>& chan) {
+    return chan.get_id();
+  }
+
+  template <class Impl>
+  static semaphore& readers(Impl& impl) {
+    return *impl.readers_slots_.impl_;
+  }
+
+  template <class Impl>
+  static semaphore& writers(Impl& impl) {
+    return *impl.writer_slots_.impl_;
+  }
+
+  // Takes a ticket, or returns false if the semaphore has none left
+  static bool try_take(semaphore& sema, bool& disabled) {
+    int result = sema.counter_.fetch_sub(1, std::memory_order_acquire);
+    disabled = semaphore::disabling_threshold < result;
+    if (disabled || result <= 0) {
+      // Given back while waiting, as routines do
+      if (disabled) sema.counter_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  // Queues the task as a waiter of the semaphore
+  static void wait(semaphore& sema, std::coroutine_handle<> handle) {
+    thread* this_thread = current_thread();
+    auto slot_index = this_thread->register_task_semaphore_wait(make_continuation(handle));
+    sema.write(this_thread, slot_index);
+    int result = sema.counter_.fetch_add(1, std::memory_order_release);
+    if (0 <= result) sema.pop_a_waiter(this_thread);
+  }
+};
+
+struct semaphore_awaiter {
+  semaphore* sema;
+
+  bool await_ready() noexcept {
+    return false;
+  }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    task_access::wait(*sema, handle);
+  }
+
+  void await_resume() noexcept {
+  }
+};
+
+}  // namespace internal
+
+/**
+ * task is a lazy stackless coroutine returning a Result
+ *
+ * It starts when awaited by another task, or when given to start_task.
+ */
+template <class Result>
+class [[nodiscard]] task {
+ public:
+  using promise_type = internal::task_promise<Result>;
+
+ private:
+  std::coroutine_handle<promise_type> handle_;
+
+  template <class Other>
+  friend void start_task(task<Other> new_task);
+
+ public:
+  explicit task(std::coroutine_handle<promise_type> handle) : handle_{handle} {
+  }
+  task(task const&) = delete;
+  task(task&& other) noexcept : handle_{std::exchange(other.handle_, {})} {
+  }
+  task& operator=(task const&) = delete;
+  task& operator=(task&& other) noexcept {
+    if (this != &other) {
+      if (handle_) handle_.destroy();
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+  ~task() {
+    if (handle_) handle_.destroy();
+  }
+
+  auto operator co_await() && noexcept {
+    struct awaiter {
+      std::coroutine_handle<promise_type> handle;
+
+      bool await_ready() noexcept {
+        return false;
+      }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+      }
+
+      Result await_resume() {
+        return handle.promise().get();
+      }
+    };
+    return awaiter{handle_};
+  }
+};
+
+namespace internal {
+template <class Result>
+task<Result> task_promise<Result>::get_return_object() {
+  return task<Result>{std::coroutine_handle<task_promise<Result>>::from_promise(*this)};
+}
+
+inline task<void> task_promise<void>::get_return_object() {
+  return task<void>{std::coroutine_handle<task_promise<void>>::from_promise(*this)};
+}
+}  // namespace internal
+
+/**
+ * Starts a task in the current thread
+ *
+ * The task runs detached: its frame is freed when it ends, and its
+ * result is dropped. Must be called from a routine or a task.
+ */
+template <class Result>
+void start_task(task<Result> new_task) {
+  auto handle = std::exchange(new_task.handle_, {});
+  handle.promise().detached = true;
+  internal::current_thread()->schedule_task(internal::make_continuation(handle));
+}
+
+/**
+ * Awaitable equivalents of the routine functions, for tasks
+ */
+namespace co {
+
+// Lets the other tasks and routines of the thread run
+inline auto yield() {
+  struct awaiter {
+    bool await_ready() noexcept {
+      return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+      internal::current_thread()->schedule_task(internal::make_continuation(handle));
+    }
+
+    void await_resume() noexcept {
+    }
+  };
+  return awaiter{};
+}
+
+inline auto sleep(std::chrono::milliseconds duration) {
+  struct awaiter {
+    std::chrono::milliseconds duration;
+
+    bool await_ready() noexcept {
+      return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+      using namespace std::chrono;
+      internal::current_thread()->register_task_timer(
+          time_point_cast<milliseconds>(high_resolution_clock::now() + duration),
+          internal::make_continuation(handle));
+    }
+
+    void await_resume() noexcept {
+    }
+  };
+  return awaiter{duration};
+}
+
+// Resumes the task once the fd is ready
+inline auto wait_readiness(fd_t fd, bool read) {
+  struct awaiter {
+    fd_t fd;
+    bool read;
+
+    bool await_ready() noexcept {
+      return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+      auto continuation = internal::make_continuation(handle);
+      if (read)
+        internal::current_thread()->register_task_read(fd, continuation);
+      else
+        internal::current_thread()->register_task_write(fd, continuation);
+    }
+
+    void await_resume() noexcept {
+    }
+  };
+  return awaiter{fd, read};
+}
+
+namespace detail {
+inline bool would_block(ssize_t return_code) {
+  return return_code < 0 && (EAGAIN == errno || EWOULDBLOCK == errno);
+}
+}  // namespace detail
+
+inline task<ssize_t> read(fd_t fd, void* buf, size_t count) {
+  ssize_t return_code = ::read(fd, buf, count);
+  while (detail::would_block(return_code)) {
+    co_await wait_readiness(fd, true);
+    return_code = ::read(fd, buf, count);
+  }
+  co_return return_code;
+}
+
+inline task<ssize_t> write(fd_t fd, void const* buf, size_t count) {
+  ssize_t return_code = ::write(fd, buf, count);
+  while (detail::would_block(return_code)) {
+    co_await wait_readiness(fd, false);
+    return_code = ::write(fd, buf, count);
+  }
+  co_return return_code;
+}
+
+inline task<ssize_t> recv(socket_t socket, void* buffer, size_t length, int flags) {
+  ssize_t return_code = ::recv(socket, buffer, length, flags);
+  while (detail::would_block(return_code)) {
+    co_await wait_readiness(socket, true);
+    return_code = ::recv(socket, buffer, length, flags);
+  }
+  co_return return_code;
+}
+
+inline task<ssize_t> send(socket_t socket, void const* buffer, size_t length, int flags) {
+  ssize_t return_code = ::send(socket, buffer, length, flags);
+  while (detail::would_block(return_code)) {
+    co_await wait_readiness(socket, false);
+    return_code = ::send(socket, buffer, length, flags);
+  }
+  co_return return_code;
+}
+
+// Takes a semaphore ticket, suspending the task until one is available
+inline task<semaphore_result> wait(semaphore& sema) {
+  bool disabled = false;
+  while (!internal::task_access::try_take(sema, disabled)) {
+    if (disabled) co_return semaphore_result{semaphore_return_value::disabled};
+    co_await internal::semaphore_awaiter{&sema};
+  }
+  co_return semaphore_result{semaphore_return_value::ok};
+}
+
+inline task<semaphore_result> wait(shared_semaphore& sema) {
+  return wait(internal::task_access::get(sema));
+}
+
+// Channels are taken by copy, as for routines
+template <class ContentType, std::size_t Size>
+task<channel_result> write(channel<ContentType, Size> chan, ContentType value) {
+  auto& impl = internal::task_access::impl(chan);
+  auto ticket = co_await wait(internal::task_access::writers(impl));
+  if (!ticket) co_return channel_result{channel_result_value::closed};
+  impl.consume_write(internal::task_access::id(chan), std::move(value));
+  co_return channel_result{channel_result_value::ok};
+}
+
+template <class ContentType, std::size_t Size>
+task<channel_result> read(channel<ContentType, Size> chan, ContentType& value) {
+  auto& impl = internal::task_access::impl(chan);
+  auto ticket = co_await wait(internal::task_access::readers(impl));
+  if (!ticket) co_return channel_result{channel_result_value::closed};
+  impl.consume_read(internal::task_access::id(chan), value);
+  co_return channel_result{channel_result_value::ok};
+}
+
+}  // namespace co
+}  // namespace boson
+
+#endif  // BOSON_USE_COROUTINES
+
+#endif  // BOSON_TASK_H_
@@ -1,100 +1,224 @@
 #include "engine.h"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <limits>
+#include "affinity.h"
+#include "exception.h"
 
 namespace boson {
 
+void engine::wake_up() {
+  // Only the first notifier since the last wake up pays for the syscall
+  if (!wakeup_pending_.exchange(true, std::memory_order_acq_rel)) {
+    uint64_t buffer{1};
+    ssize_t nb_bytes = ::write(wakeup_fd_, &buffer, sizeof(buffer));
+    if (nb_bytes < 0) {
+      throw exception(std::string("Syscall error (write): ") + ::strerror(errno));
+    }
+  }
+}
+
 void engine::push_command(thread_id from, std::unique_ptr<command> new_command) {
-  command_pushers_.fetch_add(std::memory_order_release);
-  // command_waiter_.notify_one();
-  //command_queue_.write(static_cast<int>(from), new_command.release());
   command_queue_.write(std::move(new_command));
-  command_waiter_.notify_one();
+  wake_up();
+}
+
+void engine::dispatch_batch(thread_id from, placement policy, internal::run_queue batch) {
+  int64_t now = steady_now();
+  size_t nb_available = 0;
+  for (thread_id id = 0; id < max_nb_cores_; ++id) nb_available += is_available(id, now) ? 1 : 0;
+  nb_available = std::max<size_t>(1, nb_available);
+  size_t chunk_size = (batch.size() + nb_available - 1) / nb_available;
+  while (!batch.empty()) {
+    internal::run_queue chunk = batch.split_front(chunk_size);
+    thread_id target_thread = place(policy, from);
+    start_thread(target_thread);
+    auto& view = *threads_.at(target_thread);
+    view.nb_sent_routines.fetch_add(chunk.size(), std::memory_order_release);
+    view.thread.push_command(max_nb_cores_, command_t::add_routines(std::move(chunk)));
+  }
 }
 
-void engine::execute_commands() {
+bool engine::execute_commands() {
+  bool executed = false;
   std::unique_ptr<command> new_command;
-  do {
-    new_command.reset(nullptr);
-    if (command_queue_.read(new_command)) {
-      switch (new_command->type) {
-        case command_type::add_routine: {
-          thread_id target_thread;
-          std::unique_ptr<internal::routine> new_routine;
-          tie(target_thread, new_routine) = move(new_command->data.raw<command_new_routine_data>());
-          if (target_thread == max_nb_cores_) {
-            target_thread = next_scheduled_thread_++;
-            next_scheduled_thread_ %= max_nb_cores_;
-          }
-          auto& view = *threads_.at(target_thread);
-          ++view.nb_routines;
-          view.thread.push_command(
-              max_nb_cores_, std::make_unique<command_t>(internal::thread_command_type::add_routine,
-                                                         move(new_routine)));
-        } break;
-        case command_type::notify_idle: {
-          auto& view = *threads_.at(new_command->from);
-          view.nb_routines = new_command->data.get<size_t>();
-        } break;
-        case command_type::notify_end_of_thread: {
-          --nb_active_threads_;
-        } break;
-        case command_type::fd_panic: {
-          int fd = new_command->data.get<int>();
-          for (auto& thread : threads_) {
-            thread->thread.push_command(
-                max_nb_cores_,
-                std::make_unique<command_t>(internal::thread_command_type::fd_panic, fd));
-          }
-        } break;
-      }
-      command_pushers_.fetch_sub(std::memory_order_release);
+  while (command_queue_.read(new_command)) {
+    executed = true;
+    switch (new_command->type) {
+      case command_type::add_routine: {
+        thread_id target_thread;
+        placement policy;
+        std::unique_ptr<internal::routine> new_routine;
+        tie(target_thread, policy, new_routine) =
+            move(new_command->data.raw<command_new_routine_data>());
+        if (target_thread == max_nb_cores_) {
+          target_thread = place(policy, new_command->from);
+        }
+        start_thread(target_thread);
+        auto& view = *threads_.at(target_thread);
+        view.nb_sent_routines.fetch_add(1, std::memory_order_release);
+        view.thread.push_command(max_nb_cores_, command_t::add_routine(move(new_routine)));
+      } break;
+      case command_type::add_routines: {
+        placement policy;
+        internal::run_queue batch;
+        std::tie(policy, batch) = std::move(new_command->data.raw<command_new_routines_data>());
+        dispatch_batch(new_command->from, policy, std::move(batch));
+      } break;
+      case command_type::fd_panic: {
+        int fd = new_command->data.get<int>();
+        for (auto& thread : threads_) {
+          // A thread not started yet has no fd
+          if (thread->started.load(std::memory_order_acquire))
+            thread->thread.push_command(max_nb_cores_, command_t::fd_panic(fd));
+        }
+      } break;
     }
+  }
+  return executed;
+}
 
-  } while (new_command || 0 < this->command_pushers_.load(std::memory_order_acquire));
+bool engine::is_quiescent(std::vector<size_t> const& reported_routines) const {
+  for (thread_id id = 0; id < max_nb_cores_; ++id) {
+    if (threads_[id]->nb_sent_routines.load(std::memory_order_acquire) != reported_routines[id])
+      return false;
+  }
+  return true;
 }
 
 void engine::wait_all_routines() {
-  std::mutex mut;
-  std::unique_lock<std::mutex> lock(mut);
-
-  while (0 < nb_active_threads_) {
-    execute_commands();
-    size_t nb_remaining_routines = 0;
-    for (auto& view_ptr : threads_) {
-      nb_remaining_routines += view_ptr->nb_routines;
-    }
-    if (0 == nb_remaining_routines) {
+  std::vector<size_t> reported_routines(max_nb_cores_, 0);
+  bool sent_end_requests = false;
+
+  while (0 < nb_active_threads_.load(std::memory_order_acquire)) {
+    // Idle reports must be read before draining commands: a command pushed
+    // by a thread before it went idle is then guaranteed to be drained
+    for (thread_id id = 0; id < max_nb_cores_; ++id)
+      reported_routines[id] = threads_[id]->nb_reported_routines.load(std::memory_order_acquire);
+
+    if (execute_commands()) continue;
+
+    if (!sent_end_requests && is_quiescent(reported_routines)) {
+      sent_end_requests = true;
+      // Nothing can start a thread anymore since no routine is left
       for (auto& thread : threads_) {
-        if (!thread->sent_end_request) {
-          thread->sent_end_request = true;
-          thread->thread.push_command(
-              max_nb_cores_,
-              std::make_unique<command_t>(internal::thread_command_type::finish, nullptr));
-        }
+        if (thread->started.load(std::memory_order_acquire))
+          thread->thread.push_command(max_nb_cores_, command_t::finish());
       }
+      continue;
     }
-    command_waiter_.wait(lock, [this] {
-      return 0 == this->nb_active_threads_ ||
-             0 < this->command_pushers_.load(std::memory_order_acquire);
-    });
+
+    // Sleep until a thread has something to say
+    uint64_t buffer{0};
+    ssize_t nb_bytes = ::read(wakeup_fd_, &buffer, sizeof(buffer));
+    if (nb_bytes < 0 && errno != EINTR) {
+      throw exception(std::string("Syscall error (read): ") + ::strerror(errno));
+    }
+    // Pairs with the exchange of wake_up. A plain store could be reordered
+    // after the reports read next: a notifier seeing true would skip the fd
+    // while its report is missed. With an exchange, such a notifier released
+    // its report to us, and any later one writes the fd again.
+    wakeup_pending_.exchange(false, std::memory_order_acq_rel);
   }
 }
 
-engine::engine(size_t max_nb_cores)
-    : nb_active_threads_{max_nb_cores},
+engine::engine(size_t max_nb_cores, engine_options options)
+    : nb_active_threads_{0},
       max_nb_cores_{max_nb_cores},
-      //command_loop_(*this, static_cast<int>(max_nb_cores + 1)),
+      options_(std::move(options)),
       command_queue_{},
-      command_pushers_{0} {
-  // Start threads
+      wakeup_fd_{::eventfd(0, EFD_CLOEXEC)},
+      blocking_pool_{options_.blocking_pool_size, options_.blocking_queue_depth} {
+  if (wakeup_fd_ < 0) {
+    throw exception(std::string("Syscall error (eventfd): ") + ::strerror(errno));
+  }
+  for (int cpu : options_.cpu_affinity) {
+    if (!internal::is_cpu_allowed(cpu)) {
+      ::close(wakeup_fd_);
+      throw exception(std::string("Invalid CPU in engine affinity: ") + std::to_string(cpu));
+    }
+  }
+  // Create every thread, so that ids are known, but only start what is needed
+  options_.min_nb_threads = std::max<size_t>(1, options_.min_nb_threads);
   threads_.reserve(max_nb_cores);
   for (size_t index = 0; index < max_nb_cores_; ++index) {
     threads_.emplace_back(new thread_view_t(*this));
-    auto& created_thread = threads_.back();
-    threads_.back()->std_thread =
-        std::thread([&created_thread]() { created_thread->thread.loop(); });
+  }
+  size_t nb_initial_threads =
+      options_.elastic ? std::min(options_.min_nb_threads, max_nb_cores_) : max_nb_cores_;
+  for (thread_id id = 0; id < nb_initial_threads; ++id) {
+    start_thread(id);
   }
 };
 
+void engine::start_thread(thread_id id) {
+  auto& view = *threads_.at(id);
+  if (view.started.load(std::memory_order_acquire)) return;
+  std::lock_guard<std::mutex> guard(start_lock_);
+  if (view.started.load(std::memory_order_relaxed)) return;
+  nb_active_threads_.fetch_add(1, std::memory_order_release);
+  nb_started_threads_.fetch_add(1, std::memory_order_release);
+  // The thread prepares itself once pinned, commands wait for it
+  std::promise<void> prepared;
+  auto is_prepared = prepared.get_future();
+  view.std_thread = std::thread([&view, &prepared]() {
+    try {
+      view.thread.prepare();
+    } catch (...) {
+      prepared.set_exception(std::current_exception());
+      return;
+    }
+    prepared.set_value();
+    view.thread.loop();
+  });
+  try {
+    is_prepared.get();
+  } catch (...) {
+    view.std_thread.join();
+    nb_active_threads_.fetch_sub(1, std::memory_order_release);
+    nb_started_threads_.fetch_sub(1, std::memory_order_release);
+    throw;
+  }
+  view.started.store(true, std::memory_order_release);
+}
+
+bool engine::is_available(thread_id id, int64_t now) const {
+  auto& view = *threads_[id];
+  if (!view.started.load(std::memory_order_acquire)) return false;
+  if (!options_.elastic || id < options_.min_nb_threads) return true;
+  int64_t idle_since = view.idle_since.load(std::memory_order_relaxed);
+  return 0 == idle_since ||
+         now - idle_since < std::chrono::nanoseconds{options_.park_after}.count();
+}
+
+thread_id engine::grow(thread_id target) {
+  auto& view = *threads_[target];
+  size_t nb_received = view.nb_received_routines.load(std::memory_order_acquire);
+  size_t in_flight = view.nb_sent_routines.load(std::memory_order_acquire) - nb_received;
+  if (view.nb_runnable.load(std::memory_order_relaxed) + in_flight <=
+      options_.elastic_start_threshold)
+    return target;
+
+  // Parked threads are woken before new ones are started
+  int64_t now = steady_now();
+  thread_id new_thread = max_nb_cores_;
+  for (thread_id id = 0; id < max_nb_cores_; ++id) {
+    if (!threads_[id]->started.load(std::memory_order_acquire)) {
+      if (new_thread == max_nb_cores_) new_thread = id;
+    } else if (!is_available(id, now)) {
+      return id;
+    }
+  }
+  if (new_thread == max_nb_cores_) return target;
+  start_thread(new_thread);
+  return new_thread;
+}
+
 void engine::event(int event_id, void* data, event_status status) {
 }
 
@@ -104,6 +228,76 @@ void engine::read(int fd, void* data, event_status status) {
 void engine::write(int fd, void* data, event_status status) {
 }
 
+thread_id engine::place(placement policy, thread_id from) {
+  switch (policy) {
+    case placement::least_loaded: {
+      thread_id target_thread = least_loaded_thread(from);
+      return options_.elastic ? grow(target_thread) : target_thread;
+    }
+    case placement::round_robin:
+    case placement::local:  // Only relevant from a thread, which would have solved it
+    default: {
+      // Next thread in turn, skipping those not started or parked
+      int64_t now = steady_now();
+      thread_id target_thread = next_scheduled_thread_;
+      for (size_t offset = 0; offset < max_nb_cores_; ++offset) {
+        thread_id candidate = (next_scheduled_thread_ + offset) % max_nb_cores_;
+        if (is_available(candidate, now)) {
+          target_thread = candidate;
+          break;
+        }
+      }
+      next_scheduled_thread_ = (target_thread + 1) % max_nb_cores_;
+      return options_.elastic ? grow(target_thread) : target_thread;
+    }
+  }
+}
+
+bool engine::is_remote(thread_id first, thread_id second) const {
+  if (max_nb_cores_ <= first || max_nb_cores_ <= second) return false;
+  int first_node = threads_[first]->numa_node.load(std::memory_order_relaxed);
+  int second_node = threads_[second]->numa_node.load(std::memory_order_relaxed);
+  return 0 <= first_node && 0 <= second_node && first_node != second_node;
+}
+
+thread_id engine::least_loaded_thread(thread_id from) const {
+  thread_id best_thread = 0;
+  size_t best_cost = std::numeric_limits<size_t>::max();
+  int64_t now = steady_now();
+  for (thread_id id = 0; id < max_nb_cores_; ++id) {
+    if (!is_available(id, now)) continue;
+    auto& view = *threads_[id];
+    // Received first, so that it never exceeds what we read as sent
+    size_t nb_received = view.nb_received_routines.load(std::memory_order_acquire);
+    size_t in_flight = view.nb_sent_routines.load(std::memory_order_acquire) - nb_received;
+    // A thread always busy weights twice as much as an idle one
+    size_t cost = (view.load.load(std::memory_order_relaxed) + in_flight + 1) *
+                  (thread_t::busy_ratio_scale + view.busy_ratio.load(std::memory_order_relaxed));
+    if (is_remote(from, id)) cost *= 2;
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_thread = id;
+    }
+  }
+  return best_thread;
+}
+
+stack_cache_stats engine::stack_stats() const {
+  stack_cache_stats stats{};
+  for (auto& thread : threads_) {
+    if (thread->started.load(std::memory_order_acquire)) thread->thread.add_stack_stats(stats);
+  }
+  return stats;
+}
+
+stack_usage_profile engine::stack_profile() const {
+  stack_usage_profile profile;
+  for (auto& thread : threads_) {
+    if (thread->started.load(std::memory_order_acquire)) thread->thread.add_stack_profile(profile);
+  }
+  return profile;
+}
+
 thread_id engine::register_thread_id() {
   auto new_id = current_thread_id_++;
   return new_id;
@@ -113,8 +307,11 @@ engine::~engine() {
   wait_all_routines();
 
   // Join everyone
+  std::lock_guard<std::mutex> guard(start_lock_);
   for (auto& thread : threads_) {
-    thread->std_thread.join();
+    if (thread->started.load(std::memory_order_relaxed)) thread->std_thread.join();
   }
+  blocking_pool_.stop();
+  ::close(wakeup_fd_);
 };
 }  // namespace boson
@@ -0,0 +1,75 @@
+#include "internal/blocking_pool.h"
+#include "exception.h"
+
+namespace boson {
+namespace internal {
+
+blocking_pool::blocking_pool(size_t nb_workers, size_t max_queued)
+    : nb_workers_{nb_workers}, max_queued_{max_queued} {
+}
+
+blocking_pool::~blocking_pool() {
+  stop();
+}
+
+bool blocking_pool::submit(task_t task) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (stopping_ || 0 == nb_workers_) throw exception("Blocking pool is not available");
+    if (max_queued_ <= tasks_.size()) {
+      nb_rejected_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    if (workers_.empty()) {
+      for (size_t index = 0; index < nb_workers_; ++index)
+        workers_.emplace_back([this]() { work(); });
+    }
+    tasks_.emplace_back(std::move(task));
+    nb_submitted_.fetch_add(1, std::memory_order_relaxed);
+  }
+  ready_.notify_one();
+  return true;
+}
+
+void blocking_pool::stop() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stopping_ = true;
+  }
+  ready_.notify_all();
+  for (auto& worker : workers_) worker.join();
+  workers_.clear();
+}
+
+void blocking_pool::work() {
+  for (;;) {
+    task_t task;
+    {
+      std::unique_lock<std::mutex> guard(lock_);
+      ready_.wait(guard, [this]() { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty()) return;
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+      nb_running_.fetch_add(1, std::memory_order_relaxed);
+    }
+    task.call();
+    nb_running_.fetch_sub(1, std::memory_order_relaxed);
+    nb_completed_.fetch_add(1, std::memory_order_relaxed);
+    task.notify();
+  }
+}
+
+blocking_pool_stats blocking_pool::stats() const {
+  size_t nb_queued = 0;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    nb_queued = tasks_.size();
+  }
+  return {nb_submitted_.load(std::memory_order_relaxed),
+          nb_completed_.load(std::memory_order_relaxed),
+          nb_rejected_.load(std::memory_order_relaxed), nb_queued,
+          nb_running_.load(std::memory_order_relaxed)};
+}
+
+}  // namespace internal
+}  // namespace boson
@@ -1,5 +1,6 @@
 #include "internal/routine.h"
 #include <cassert>
+#include <cstring>
 #include "exception.h"
 #include "internal/thread.h"
 #include "syscalls.h"
@@ -17,14 +18,21 @@ void resume_routine(transfer_t transfered_context) {
   current_routine->status_ = routine_status::running;
   (*current_routine->func_)();
   current_routine->status_ = routine_status::finished;
-  jump_fcontext(this_thread->context().fctx, nullptr);
+  // The routine may have been resumed by another thread meanwhile
+  jump_fcontext(current_routine->thread_->context().fctx, nullptr);
 }
 }
 
 // class routine;
 
 routine::~routine() {
-  deallocate(stack_);
+  if (stack_.sp) {
+    // Only routines that ran have a stack, they are deleted by their thread
+    if (thread_)
+      thread_->release_stack(*this);
+    else
+      deallocate(stack_);
+  }
 }
 
 void routine::start_event_round() {
@@ -32,8 +40,11 @@ void routine::start_event_round() {
   //previous_events_.clear();
   //std::swap(previous_events_, events_);
   events_.clear();
-  // Create new event pointer
-  current_ptr_ = routine_local_ptr_t(std::unique_ptr<routine>(this));
+  // Create new event pointer, reusing the previous one if nothing references it anymore
+  if (current_ptr_.unique())
+    current_ptr_.emplace(std::unique_ptr<routine>(this));
+  else
+    current_ptr_ = routine_local_ptr_t(std::unique_ptr<routine>(this));
 }
 
 void routine::add_semaphore_wait(semaphore* sema) {
@@ -48,10 +59,12 @@ void routine::add_semaphore_wait(semaphore* sema) {
 }
 
 void routine::add_timer(routine_time_point date) {
-  events_.emplace_back(waited_event{event_type::timer, routine_timer_event_data{std::move(date),nullptr}});
+  events_.emplace_back(
+      waited_event{event_type::timer, routine_timer_event_data{std::move(date), 0}});
   auto& event = events_.back();
-  event.data.get<routine_timer_event_data>().neighbor_timers =
-      &thread_->register_timer(event.data.get<routine_timer_event_data>().date, routine_slot{current_ptr_,events_.size()-1});
+  event.data.get<routine_timer_event_data>().slot_index =
+      thread_->register_timer(event.data.get<routine_timer_event_data>().date,
+                              routine_slot{current_ptr_, events_.size() - 1});
 }
 
 void routine::add_read(int fd) {
@@ -68,7 +81,9 @@ void routine::add_write(int fd) {
 
 size_t routine::commit_event_round() {
   status_ = routine_status::wait_events;
-  thread_->context() = jump_fcontext(thread_->context().fctx, nullptr);
+  transfer_t thread_context = jump_fcontext(thread_->context().fctx, nullptr);
+  // thread_ must be read after the jump since it changes when the routine migrates
+  thread_->context() = thread_context;
   return happened_index_;
 }
 
@@ -79,8 +94,7 @@ void routine::cancel_event_round() {
       case event_type::none:
         break;
       case event_type::timer: {
-        auto& data = other.data.get<routine_timer_event_data>();
-        --data.neighbor_timers->nb_active;
+        thread_->cancel_timer(other.data.get<routine_timer_event_data>().slot_index);
       } break;
       case event_type::io_read:
         --thread_->nb_suspended_routines_;
@@ -112,7 +126,7 @@ void routine::cancel_event_round() {
 
 void routine::set_as_semaphore_event_candidate(std::size_t index) {
   status_ = routine_status::sema_event_candidate;
-  thread_->scheduled_routines_.emplace_back(routine_slot{current_ptr_,index});
+  thread_->semaphore_candidates_.emplace_back(routine_slot{current_ptr_,index});
 }
 
 bool routine::event_happened(std::size_t index, event_status status) {
@@ -171,8 +185,7 @@ bool routine::event_happened(std::size_t index, event_status status) {
         case event_type::none:
           break;
         case event_type::timer: {
-            auto& data = other.data.get<routine_timer_event_data>();
-            --data.neighbor_timers->nb_active;
+            thread_->cancel_timer(other.data.get<routine_timer_event_data>().slot_index);
           }
           break;
         case event_type::io_read:
@@ -207,7 +220,7 @@ bool routine::event_happened(std::size_t index, event_status status) {
     return true;
   }
   else if (happened_type_ != event_type::none) {
-    thread_->scheduled_routines_.emplace_back(routine_slot{routine_local_ptr_t(std::unique_ptr<routine>(current_ptr_->release())),0});
+    thread_->scheduled_routines_.push_back(current_ptr_->release());
     current_ptr_.invalidate_all();
     status_ = routine_status::yielding;
     happened_index_ = index;
@@ -217,10 +230,23 @@ bool routine::event_happened(std::size_t index, event_status status) {
   return false;
 }
 
+void routine::save_shared_stack() {
+  // The context is saved at the lowest address in use
+  char* bottom = static_cast<char*>(context_.fctx);
+  saved_stack_.assign(bottom, static_cast<char*>(stack_.sp));
+}
+
+void routine::restore_shared_stack() {
+  char* top = static_cast<char*>(stack_.sp);
+  std::memcpy(top - saved_stack_.size(), saved_stack_.data(), saved_stack_.size());
+}
+
 void routine::resume(thread* managing_thread) {
   thread_ = managing_thread;
+  if (schedule_.shared_stack) managing_thread->claim_shared_stack(this);
   switch (status_) {
     case routine_status::is_new: {
+      stack_ = managing_thread->acquire_stack(*this);
       context_.fctx = make_fcontext(stack_.sp, stack_.size, detail::resume_routine);
       context_ = jump_fcontext(context_.fctx, nullptr);
       break;
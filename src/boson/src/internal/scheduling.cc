@@ -0,0 +1,117 @@
+#include "internal/scheduling.h"
+#include <algorithm>
+
+namespace boson {
+namespace internal {
+
+run_queue::run_queue(run_queue&& other)
+    : head_{other.head_}, tail_{other.tail_}, size_{other.size_} {
+  other.head_ = other.tail_ = nullptr;
+  other.size_ = 0;
+}
+
+run_queue& run_queue::operator=(run_queue&& other) {
+  run_queue dropped{std::move(*this)};
+  swap(other);
+  return *this;
+}
+
+run_queue::~run_queue() {
+  while (!empty()) delete pop_front();
+}
+
+void run_queue::splice_back(run_queue& other) {
+  if (other.empty()) return;
+  if (tail_)
+    tail_->next_scheduled_ = other.head_;
+  else
+    head_ = other.head_;
+  tail_ = other.tail_;
+  size_ += other.size_;
+  other.head_ = other.tail_ = nullptr;
+  other.size_ = 0;
+}
+
+void run_queue::splice_front(run_queue& other) {
+  other.splice_back(*this);
+  swap(other);
+}
+
+void run_queue::swap(run_queue& other) {
+  std::swap(head_, other.head_);
+  std::swap(tail_, other.tail_);
+  std::swap(size_, other.size_);
+}
+
+run_queue run_queue::split_front(std::size_t count) {
+  run_queue front;
+  while (!empty() && front.size() < count) front.push_back(pop_front());
+  return front;
+}
+
+routine* run_queue::release() {
+  routine* first = head_;
+  head_ = tail_ = nullptr;
+  size_ = 0;
+  return first;
+}
+
+void run_queue::adopt(routine* first) {
+  while (first) {
+    routine* next = first->next_scheduled_;
+    push_back(first);
+    first = next;
+  }
+}
+
+priority_scheduling::priority_scheduling(size_t starvation_limit)
+    : starvation_limit_{starvation_limit} {
+}
+
+void priority_scheduling::prepare_round(run_queue& round, run_queue& next_round) {
+  // One queue per class keeps the order within each class
+  run_queue classes[3];
+  while (!round.empty()) {
+    routine* current = round.pop_front();
+    classes[static_cast<size_t>(current->schedule().priority)].push_back(current);
+  }
+  size_t nb_classes = 0;
+  for (auto& class_queue : classes) nb_classes += class_queue.empty() ? 0 : 1;
+
+  if (nb_classes <= 1 || starvation_limit_ <= nb_postponed_rounds_) {
+    // Let everyone run once, most urgent first
+    nb_postponed_rounds_ = 0;
+    for (auto& class_queue : classes) round.splice_back(class_queue);
+    return;
+  }
+
+  // Only the most urgent class runs this round
+  ++nb_postponed_rounds_;
+  auto urgent = std::find_if(std::begin(classes), std::end(classes),
+                             [](run_queue const& class_queue) { return !class_queue.empty(); });
+  round.swap(*urgent);
+  run_queue postponed;
+  for (auto& class_queue : classes) postponed.splice_back(class_queue);
+  next_round.splice_front(postponed);
+}
+
+void deadline_scheduling::prepare_round(run_queue& round, run_queue&) {
+  round.stable_sort([](routine const& left, routine const& right) {
+    return left.schedule().deadline < right.schedule().deadline;
+  });
+}
+
+std::unique_ptr<scheduling_policy> make_scheduling_policy(engine_options const& options) {
+  switch (options.scheduling_policy) {
+    case scheduling::priority:
+      return std::make_unique<priority_scheduling>(options.starvation_limit);
+    case scheduling::earliest_deadline:
+      return std::make_unique<deadline_scheduling>();
+    case scheduling::fifo:
+    default:
+      return nullptr;
+  }
+}
+
+}  // namespace internal
+}  // namespace boson
@@ -1,4 +1,6 @@
 #include "internal/stack.h"
+#include <algorithm>
+#include <cstdint>
 
 namespace boson {
 namespace internal {
@@ -8,9 +10,248 @@ void deallocate(stack_context& sctx) noexcept {
   VALGRIND_STACK_DEREGISTER(sctx.valgrind_stack_id);
 #endif
 
-  void* vp = static_cast<char*>(sctx.sp) - sctx.size;
+  void* vp = static_cast<char*>(sctx.sp) - sctx.size - sctx.guard_size;
   // conform to POSIX.4 (POSIX.1b-1993, _POSIX_C_SOURCE=199309L)
-  ::munmap(vp, sctx.size);
+  ::munmap(vp, sctx.size + sctx.guard_size);
+}
+
+namespace {
+template <template <bool> class Traits>
+inline stack_context allocate_class(bool is_protected) {
+  return is_protected ? allocate<Traits<true>>() : allocate<Traits<false>>();
+}
+}
+
+stack_context allocate(stack_class size_class, bool is_protected) {
+  stack_context sctx;
+  switch (size_class) {
+    case stack_class::tiny:
+      sctx = allocate_class<tiny_stack_traits>(is_protected);
+      break;
+    case stack_class::medium:
+      sctx = allocate_class<medium_stack_traits>(is_protected);
+      break;
+    case stack_class::large:
+      sctx = allocate_class<large_stack_traits>(is_protected);
+      break;
+    case stack_class::small:
+    default:
+      sctx = allocate_class<small_stack_traits>(is_protected);
+      break;
+  }
+  sctx.size_class = size_class;
+  return sctx;
+}
+
+bool prefault_stack(void* top, std::size_t size, bool lock) noexcept {
+  std::size_t page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+  char* bottom = static_cast<char*>(top) - size;
+  if (lock && 0 == ::mlock(bottom, size)) return true;
+  // Writes, so that the zero page is not mapped instead
+  for (char* page = static_cast<char*>(top) - page_size; bottom <= page; page -= page_size)
+    *static_cast<volatile char*>(page) = 0;
+  return !lock;
+}
+
+namespace {
+constexpr std::size_t arena_size = 2 * 1024 * 1024;
+
+// Maps an arena aligned on its size, so that it can be backed by huge pages
+char* map_arena() {
+  void* vp = ::mmap(0, 2 * arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (MAP_FAILED == vp) throw std::bad_alloc();
+  auto address = reinterpret_cast<std::uintptr_t>(vp);
+  auto aligned = (address + arena_size - 1) & ~(arena_size - 1);
+  if (address < aligned) ::munmap(vp, aligned - address);
+  if (aligned + arena_size < address + 2 * arena_size)
+    ::munmap(reinterpret_cast<void*>(aligned + arena_size),
+             address + 2 * arena_size - aligned - arena_size);
+  char* arena = reinterpret_cast<char*>(aligned);
+#if defined(MADV_HUGEPAGE)
+  ::madvise(arena, arena_size, MADV_HUGEPAGE);
+#endif
+  return arena;
+}
+
+std::size_t round_to_page(std::size_t size) {
+  std::size_t page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+  return (size + page_size - 1) / page_size * page_size;
+}
+}
+
+stack_cache::stack_cache(engine_options const& options)
+    : capacity_{options.stack_cache_size},
+      high_water_mark_{std::min(options.stack_cache_high_water_mark, options.stack_cache_size)},
+      backing_{options.stack_backing},
+      prefault_size_{round_to_page(options.stack_prefault_size)},
+      lock_{options.stack_lock} {
+  // A guard page would split the huge pages of the arena it is carved from
+  for (std::size_t index = 0; index < nb_stack_classes; ++index)
+    pools_[index].is_protected =
+        options.stack_guards[index] && backing_ != stack_memory::huge_pages;
+}
+
+stack_cache::~stack_cache() {
+  for (auto& pool : pools_) {
+    for (auto& sctx : pool.resident_stacks) deallocate(sctx);
+    for (auto& sctx : pool.trimmed_stacks) deallocate(sctx);
+    if (pool.arena_next != pool.arena_end)
+      ::munmap(pool.arena_next, pool.arena_end - pool.arena_next);
+  }
+}
+
+stack_context stack_cache::carve_stack(stack_class size_class, pool& class_pool) {
+  std::size_t stack_size = stack_class_size(size_class);
+  if (static_cast<std::size_t>(class_pool.arena_end - class_pool.arena_next) < stack_size) {
+    // The rest is too small for this class, it is given back
+    if (class_pool.arena_next != class_pool.arena_end)
+      ::munmap(class_pool.arena_next, class_pool.arena_end - class_pool.arena_next);
+    class_pool.arena_next = map_arena();
+    class_pool.arena_end = class_pool.arena_next + arena_size;
+  }
+  char* vp = class_pool.arena_next;
+  class_pool.arena_next += stack_size;
+
+  stack_context sctx;
+  sctx.size = stack_size;
+  sctx.guard_size = 0;
+  sctx.sp = vp + stack_size;
+  sctx.size_class = size_class;
+#if defined(BOSON_USE_VALGRIND)
+  sctx.valgrind_stack_id = VALGRIND_STACK_REGISTER(sctx.sp, vp);
+#endif
+  return sctx;
+}
+
+stack_context stack_cache::map_stack(stack_class size_class, pool& class_pool) {
+  stack_context sctx = backing_ == stack_memory::huge_pages
+                           ? carve_stack(size_class, class_pool)
+                           : allocate(size_class, class_pool.is_protected);
+  if (0 < prefault_size_) prefault_stack(sctx.sp, std::min(prefault_size_, sctx.size), lock_);
+  return sctx;
+}
+
+stack_context stack_cache::get(stack_class size_class) {
+  auto& pool = pools_[static_cast<std::size_t>(size_class)];
+  auto& stacks = pool.resident_stacks.empty() ? pool.trimmed_stacks : pool.resident_stacks;
+  if (stacks.empty()) {
+    nb_misses_.fetch_add(1, std::memory_order_relaxed);
+    return map_stack(size_class, pool);
+  }
+  nb_hits_.fetch_add(1, std::memory_order_relaxed);
+  nb_cached_.fetch_sub(1, std::memory_order_relaxed);
+  stack_context sctx = stacks.back();
+  stacks.pop_back();
+  return sctx;
+}
+
+void stack_cache::put(stack_context& sctx) noexcept {
+  auto& pool = pools_[static_cast<std::size_t>(sctx.size_class)];
+  if (pool.resident_stacks.size() < high_water_mark_) {
+    pool.resident_stacks.push_back(sctx);
+  } else if (pool.resident_stacks.size() + pool.trimmed_stacks.size() < capacity_) {
+    // Keeps the mapping and the prefaulted top, the rest is faulted in again on reuse
+    std::size_t kept_size = std::min(prefault_size_, sctx.size);
+    ::madvise(static_cast<char*>(sctx.sp) - sctx.size, sctx.size - kept_size, MADV_DONTNEED);
+    nb_trimmed_.fetch_add(1, std::memory_order_relaxed);
+    pool.trimmed_stacks.push_back(sctx);
+  } else {
+    deallocate(sctx);
+    sctx = stack_context{};
+    return;
+  }
+  nb_cached_.fetch_add(1, std::memory_order_relaxed);
+  sctx = stack_context{};
+}
+
+std::size_t stack_class_size(stack_class size_class) {
+  switch (size_class) {
+    case stack_class::tiny:
+      return tiny_stack_traits<false>::stack_size;
+    case stack_class::medium:
+      return medium_stack_traits<false>::stack_size;
+    case stack_class::large:
+      return large_stack_traits<false>::stack_size;
+    case stack_class::small:
+    default:
+      return small_stack_traits<false>::stack_size;
+  }
+}
+
+stack_class fitting_stack_class(std::size_t used) {
+  for (std::size_t index = 0; index < nb_stack_classes; ++index) {
+    auto size_class = static_cast<stack_class>(index);
+    if (used + used / 2 <= stack_class_size(size_class)) return size_class;
+  }
+  return stack_class::large;
+}
+
+namespace {
+constexpr std::uint64_t stack_canary = 0xb05015dead57ac4bULL;
+}
+
+void paint_stack(stack_context const& sctx) noexcept {
+  auto* word = reinterpret_cast<std::uint64_t*>(static_cast<char*>(sctx.sp) - sctx.size);
+  auto* end = static_cast<std::uint64_t*>(sctx.sp);
+  for (; word != end; ++word) *word = stack_canary;
+}
+
+std::size_t used_stack_size(stack_context const& sctx) noexcept {
+  // The stack grows down, so the untouched canaries are at the bottom
+  auto* word = reinterpret_cast<std::uint64_t const*>(static_cast<char*>(sctx.sp) - sctx.size);
+  auto* end = static_cast<std::uint64_t const*>(sctx.sp);
+  while (word != end && *word == stack_canary) ++word;
+  return reinterpret_cast<char const*>(end) - reinterpret_cast<char const*>(word);
+}
+
+stack_profiler::stack_profiler(std::size_t min_samples) : min_samples_{min_samples} {
+}
+
+void stack_profiler::record(std::type_index type, stack_context const& sctx) {
+  std::size_t used = used_stack_size(sctx);
+  std::lock_guard<std::mutex> guard(lock_);
+  auto result = profile_.emplace(type, stack_usage{0, 0, stack_class::tiny});
+  auto& usage = result.first->second;
+  ++usage.nb_samples;
+  if (usage.max_used < used) {
+    // A stack used up to its bottom may have overflowed, so the class grows
+    usage.max_used = used;
+    usage.suggested_class = fitting_stack_class(used);
+  }
+}
+
+stack_class stack_profiler::suggest(std::type_index type, stack_class fallback) const {
+  // Only the owning thread writes, which is the caller
+  auto it = profile_.find(type);
+  if (it == profile_.end() || it->second.nb_samples < min_samples_) return fallback;
+  return it->second.suggested_class;
+}
+
+void stack_profiler::merge_into(stack_usage_profile& profile) const {
+  std::lock_guard<std::mutex> guard(lock_);
+  for (auto const& entry : profile_) {
+    auto result = profile.emplace(entry.first, stack_usage{0, 0, stack_class::tiny});
+    auto& usage = result.first->second;
+    usage.nb_samples += entry.second.nb_samples;
+    if (usage.max_used < entry.second.max_used) {
+      usage.max_used = entry.second.max_used;
+      usage.suggested_class = entry.second.suggested_class;
+    }
+  }
+}
+
+stack_class stack_cache::guarded_class(stack_class at_least, stack_class fallback) const {
+  for (auto index = static_cast<std::size_t>(at_least); index < nb_stack_classes; ++index) {
+    if (pools_[index].is_protected) return static_cast<stack_class>(index);
+  }
+  return fallback;
+}
+
+void stack_cache::add_stats(stack_cache_stats& stats) const {
+  stats.nb_hits += nb_hits_.load(std::memory_order_relaxed);
+  stats.nb_misses += nb_misses_.load(std::memory_order_relaxed);
+  stats.nb_cached += nb_cached_.load(std::memory_order_relaxed);
+  stats.nb_trimmed += nb_trimmed_.load(std::memory_order_relaxed);
 }
 }
 }
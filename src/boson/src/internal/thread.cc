@@ -1,6 +1,13 @@
 #include "internal/thread.h"
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cstring>
+#include <limits>
+#include "affinity.h"
 #include "engine.h"
 #include "exception.h"
 #include "internal/routine.h"
@@ -10,6 +17,13 @@
 namespace boson {
 namespace internal {
 
+namespace {
+// Heap order of the timers, the closest on top
+inline bool is_later(timer_entry const& left, timer_entry const& right) {
+  return right.date < left.date || (right.date == left.date && right.sequence < left.sequence);
+}
+}
+
 // class engine_proxy;
 
 engine_proxy::engine_proxy(engine& parent_engine) : engine_(&parent_engine) {
@@ -20,32 +34,61 @@ engine_proxy::~engine_proxy() {
 }
 
 void engine_proxy::notify_end() {
-  engine_->push_command(current_thread_id_,
-                        std::make_unique<engine::command>(
-                            current_thread_id_, engine::command_type::notify_end_of_thread,
-                            engine::command_data{nullptr}));
+  engine_->nb_active_threads_.fetch_sub(1, std::memory_order_release);
+  engine_->wake_up();
 }
 
 routine_id engine_proxy::get_new_routine_id() {
-  return engine_->current_routine_id_++;
+  if (next_routine_id_ == last_routine_id_) {
+    next_routine_id_ =
+        engine_->current_routine_id_.fetch_add(routine_id_block_size, std::memory_order_relaxed);
+    last_routine_id_ = next_routine_id_ + routine_id_block_size;
+  }
+  return next_routine_id_++;
 }
 
-void engine_proxy::notify_idle(size_t nb_suspended_routines) {
-  engine_->push_command(
-      current_thread_id_,
-      std::make_unique<engine::command>(current_thread_id_, engine::command_type::notify_idle,
-                                        engine::command_data{nb_suspended_routines}));
+void engine_proxy::notify_idle(size_t nb_received_routines) {
+  auto& view = *engine_->threads_[current_thread_id_];
+  // The thread cannot get busy again without receiving a routine, so an
+  // unchanged count means the engine already knows we are idle
+  if (view.nb_reported_routines.load(std::memory_order_relaxed) != nb_received_routines) {
+    view.nb_reported_routines.store(nb_received_routines, std::memory_order_release);
+    engine_->wake_up();
+  }
 }
 
 void engine_proxy::start_routine(std::unique_ptr<routine> new_routine) {
-  start_routine(engine_->max_nb_cores(), std::move(new_routine));
+  start_routine(engine_->options().default_placement, std::move(new_routine));
+}
+
+void engine_proxy::start_routine(placement policy, std::unique_ptr<routine> new_routine) {
+  if (placement::local == policy) {
+    start_routine(current_thread_id_, std::move(new_routine));
+    return;
+  }
+  thread_id target_thread = engine_->max_nb_cores();
+  engine_->push_command(
+      current_thread_id_,
+      std::make_unique<engine::command>(
+          target_thread, engine::command_type::add_routine,
+          engine::command_new_routine_data{target_thread, policy, std::move(new_routine)}));
 }
 
 void engine_proxy::start_routine(thread_id target_thread, std::unique_ptr<routine> new_routine) {
-  engine_->push_command(current_thread_id_, std::make_unique<engine::command>(
-                                                target_thread, engine::command_type::add_routine,
-                                                engine::command_new_routine_data{
-                                                    target_thread, std::move(new_routine)}));
+  engine_->start_thread(target_thread);
+  auto& view = *engine_->threads_.at(target_thread);
+  // Accounted before the push so the engine never sees the routine missing
+  view.nb_sent_routines.fetch_add(1, std::memory_order_release);
+  view.thread.push_command(current_thread_id_, thread_command::add_routine(std::move(new_routine)));
+}
+
+void engine_proxy::start_routines(placement policy, run_queue batch) {
+  if (batch.empty()) return;
+  engine_->push_command(
+      current_thread_id_,
+      std::make_unique<engine::command>(
+          current_thread_id_, engine::command_type::add_routines,
+          engine::command_new_routines_data{policy, std::move(batch)}));
 }
 
 void engine_proxy::fd_panic(int fd) {
@@ -54,45 +97,159 @@ void engine_proxy::fd_panic(int fd) {
       std::make_unique<engine::command>(current_thread_id_, engine::command_type::fd_panic, fd));
 }
 
+bool engine_proxy::submit_blocking(std::function<void()> call, std::function<void()> notify) {
+  return engine_->blocking_pool_.submit({std::move(call), std::move(notify)});
+}
+
 void engine_proxy::set_id() {
   current_thread_id_ = engine_->register_thread_id();
 }
 
+void engine_proxy::set_hungry(bool hungry) {
+  auto& view = *engine_->threads_[current_thread_id_];
+  // Every transition is counted once, by whoever made it
+  if (view.hungry.load(std::memory_order_relaxed) != hungry &&
+      view.hungry.exchange(hungry, std::memory_order_acq_rel) != hungry) {
+    engine_->nb_hungry_threads_.fetch_add(hungry ? 1 : -1, std::memory_order_release);
+  }
+}
+
+void engine_proxy::publish_load(size_t nb_routines, size_t nb_runnable,
+                                size_t nb_received_routines, size_t busy_ratio) {
+  auto& view = *engine_->threads_[current_thread_id_];
+  view.load.store(nb_routines, std::memory_order_relaxed);
+  view.nb_runnable.store(nb_runnable, std::memory_order_relaxed);
+  if (0 < nb_routines)
+    view.idle_since.store(0, std::memory_order_relaxed);
+  else if (0 == view.idle_since.load(std::memory_order_relaxed))
+    view.idle_since.store(engine::steady_now(), std::memory_order_relaxed);
+  view.busy_ratio.store(busy_ratio, std::memory_order_relaxed);
+  view.nb_received_routines.store(nb_received_routines, std::memory_order_release);
+}
+
+bool engine_proxy::has_hungry_threads() const {
+  return 0 < engine_->nb_hungry_threads_.load(std::memory_order_acquire);
+}
+
+thread_id engine_proxy::claim_hungry_thread() {
+  size_t nb_threads = engine_->max_nb_cores();
+  // Local threads first, then remote ones
+  for (bool remote : {false, true}) {
+    // Start right after ourselves to spread the load
+    for (size_t offset = 1; offset < nb_threads; ++offset) {
+      thread_id candidate = (current_thread_id_ + offset) % nb_threads;
+      if (engine_->is_remote(current_thread_id_, candidate) != remote) continue;
+      bool expected = true;
+      if (engine_->threads_[candidate]->hungry.compare_exchange_strong(
+              expected, false, std::memory_order_acq_rel)) {
+        engine_->nb_hungry_threads_.fetch_sub(1, std::memory_order_release);
+        return candidate;
+      }
+    }
+  }
+  return nb_threads;
+}
+
+void engine_proxy::apply_affinity() {
+  auto const& options = engine_->options();
+  if (!options.cpu_affinity.empty())
+    pin_current_thread(options.cpu_affinity[current_thread_id_ % options.cpu_affinity.size()]);
+  // Once pinned, the node we run on is the one we stay on
+  int node = current_numa_node();
+  engine_->threads_[current_thread_id_]->numa_node.store(node, std::memory_order_relaxed);
+  if (options.numa_local_memory && 0 <= node) prefer_numa_node(node);
+}
+
 void thread::handle_engine_event() {
-  //thread_command* received_command = nullptr;
-  //while ((received_command = static_cast<thread_command*>(engine_queue_.read(id())))) {
-  std::unique_ptr<thread_command> received_command;
+  // Cleared before draining: a command pushed after this point is either
+  // drained below or signaled again. Acquire pairs with the push exchange.
+  wakeup_pending_.exchange(false, std::memory_order_acq_rel);
+  for (std::size_t index = 0; index < command_rings_.size(); ++index) drain_command_ring(index);
+  thread_command received_command{};
   while (engine_queue_.read(received_command)) {
     nb_pending_commands_.fetch_sub(1);
-    switch (received_command->type) {
-      case thread_command_type::add_routine:
-        scheduled_routines_.emplace_back(
-                routine_slot{std::move(received_command->data.get<routine_ptr_t>()), 0});
-        break;
-      case thread_command_type::schedule_waiting_routine: {
-        auto& data = received_command->data.get<std::pair<std::weak_ptr<semaphore>, std::size_t>>();
-        auto& shared_routine = suspended_slots_[data.second];
-        // If not previously invalidated by a timeout
-        if (shared_routine.ptr) {
-          shared_routine.ptr->get()->set_as_semaphore_event_candidate(shared_routine.event_index);
-        }
-        else {
-          auto sema_pointer = data.first.lock();
-          if (sema_pointer)
-            sema_pointer->pop_a_waiter(this);
-        }
-        suspended_slots_.free(data.second);
-      } break;
-      case thread_command_type::finish:
-        status_ = thread_status::finishing;
-        break;
-      case thread_command_type::fd_panic:
-        auto& fd = received_command->data.get<int>();
-        loop_->send_fd_panic(id(),fd);
-        break;
+    thread_id from = received_command.from;
+    bool has_ring = from < command_rings_.size();
+    // Commands its sender put in the ring before spilling come first
+    if (has_ring) drain_command_ring(from);
+    execute_command(received_command);
+    if (has_ring) nb_spilled_commands_[from].fetch_sub(1, std::memory_order_release);
+  }
+}
+
+void thread::drain_command_ring(std::size_t index) {
+  thread_command received_command{};
+  while (command_rings_[index]->read(received_command)) {
+    nb_pending_commands_.fetch_sub(1);
+    execute_command(received_command);
+  }
+}
+
+void thread::push_local_command(thread_command command) {
+  local_commands_.emplace_back(std::move(command));
+}
+
+void thread::execute_local_commands() {
+  // Executing a command may push another one
+  for (size_t index = 0; index < local_commands_.size(); ++index) {
+    thread_command command = std::move(local_commands_[index]);
+    execute_command(command);
+  }
+  local_commands_.clear();
+  resolve_semaphore_candidates();
+}
+
+void thread::resolve_semaphore_candidates() {
+  // A candidacy may not add another one, the index is only defensive
+  for (size_t index = 0; index < semaphore_candidates_.size(); ++index) {
+    auto& slot = semaphore_candidates_[index];
+    // Invalidated if the routine already got another event
+    if (!slot.ptr) continue;
+    auto routine = slot.ptr->get();
+    if (routine->event_happened(slot.event_index)) {
+      // The routine gave back its ownership
+      scheduled_routines_.push_back(routine);
+    } else {
+      routine->status_ = routine_status::wait_events;
     }
-    //delete received_command;
-    //received_command.reset(nullptr);
+  }
+  semaphore_candidates_.clear();
+}
+
+void thread::execute_command(thread_command& command) {
+  switch (command.type) {
+    case thread_command_type::add_routine:
+      ++nb_received_routines_;
+      scheduled_routines_.push_back(command.new_routine);
+      command.new_routine = nullptr;
+      break;
+    case thread_command_type::add_routines:
+      nb_received_routines_ += command.nb_routines;
+      scheduled_routines_.adopt(command.new_routine);
+      command.new_routine = nullptr;
+      break;
+    case thread_command_type::schedule_waiting_routine: {
+      auto& shared_routine = suspended_slots_[command.slot_index];
+      // If not previously invalidated by a timeout
+      if (shared_routine.ptr) {
+        shared_routine.ptr->get()->set_as_semaphore_event_candidate(shared_routine.event_index);
+      }
+      else if (wake_task(shared_routine)) {
+        // The task tries to win the ticket again when resumed
+        --nb_suspended_routines_;
+      }
+      else {
+        // Pass the ticket on, unless the semaphore is gone meanwhile
+        semaphore::pop_a_waiter(command.sema, this);
+      }
+      free_slot(command.slot_index);
+    } break;
+    case thread_command_type::finish:
+      status_ = thread_status::finishing;
+      break;
+    case thread_command_type::fd_panic:
+      loop_->send_fd_panic(id(), command.fd);
+      break;
   }
 }
 
@@ -101,13 +258,43 @@ void thread::unregister_all_events() {
   //loop_->unregister(self_event_id_);
 }
 
-timed_routines_set& thread::register_timer(routine_time_point const& date, routine_slot slot) {
+std::size_t thread::register_timer(routine_time_point const& date, routine_slot slot) {
   auto index = suspended_slots_.allocate();
   suspended_slots_[index] = slot;
-  auto& current_set = timed_routines_[date];
-  current_set.slots.emplace_back(index);
-  ++current_set.nb_active;
-  return current_set;
+  timers_.emplace_back(timer_entry{date, nb_registered_timers_++, index});
+  std::push_heap(begin(timers_), end(timers_), is_later);
+  return index;
+}
+
+void thread::cancel_timer(std::size_t slot_index) {
+  suspended_slots_[slot_index].ptr = nullptr;
+}
+
+void thread::fire_timers() {
+  if (timers_.empty()) return;
+  auto date = timers_.front().date;
+  while (!timers_.empty() && timers_.front().date <= date) {
+    std::pop_heap(begin(timers_), end(timers_), is_later);
+    auto slot_index = timers_.back().slot_index;
+    timers_.pop_back();
+    auto& slot = suspended_slots_[slot_index];
+    if (slot.ptr)
+      slot.ptr->get()->event_happened(slot.event_index);
+    else
+      wake_task(slot);
+    free_slot(slot_index);
+  }
+}
+
+void thread::clean_canceled_timers() {
+  while (!timers_.empty()) {
+    auto const& slot = suspended_slots_[timers_.front().slot_index];
+    // Timers of tasks are never canceled
+    if (slot.ptr || slot.task.resume) break;
+    std::pop_heap(begin(timers_), end(timers_), is_later);
+    free_slot(timers_.back().slot_index);
+    timers_.pop_back();
+  }
 }
 
 std::size_t thread::register_semaphore_wait(routine_slot slot) {
@@ -149,20 +336,129 @@ int thread::register_write(int fd, routine_slot slot) {
   return existing_write;
 }
 
+stack_context thread::acquire_stack(routine const& new_routine) {
+  if (new_routine.schedule().shared_stack) {
+    if (!shared_stack_.sp) shared_stack_ = stack_cache_.get(shared_stack_class_);
+    return shared_stack_;
+  }
+  stack_class size_class = new_routine.schedule().stack;
+  // An explicit class is kept, only the default one is learnt. The learnt
+  // class only bounds the samples seen so far, so a deeper call must fault
+  // on a guard page rather than overwrite the mapping below: routines only
+  // move to guarded classes, and only shrink if one is below the default.
+  if (auto_stack_sizing_ && size_class == start_options{}.stack) {
+    stack_class learnt = stack_profiler_.suggest(new_routine.function_type(), size_class);
+    if (learnt < size_class) {
+      stack_class guarded = stack_cache_.guarded_class(learnt, size_class);
+      if (guarded < size_class) size_class = guarded;
+    } else if (size_class < learnt) {
+      size_class = stack_cache_.guarded_class(learnt, learnt);
+    }
+  }
+  stack_context sctx = stack_cache_.get(size_class);
+  if (stack_profiling_) paint_stack(sctx);
+  return sctx;
+}
+
+void thread::release_stack(routine& old_routine) {
+  if (old_routine.schedule().shared_stack) {
+    if (shared_stack_owner_ == &old_routine) shared_stack_owner_ = nullptr;
+    return;
+  }
+  if (stack_profiling_) stack_profiler_.record(old_routine.function_type(), old_routine.stack_);
+  stack_cache_.put(old_routine.stack_);
+}
+
+void thread::claim_shared_stack(routine* new_owner) {
+  if (shared_stack_owner_ == new_owner) return;
+  if (shared_stack_owner_) shared_stack_owner_->save_shared_stack();
+  shared_stack_owner_ = new_owner;
+  if (new_owner->status() != routine_status::is_new) new_owner->restore_shared_stack();
+}
+
+namespace {
+// Counts the event for the calling thread only, in user space
+int open_perf_event(uint32_t type, uint64_t config) {
+  perf_event_attr attributes;
+  std::memset(&attributes, 0, sizeof(attributes));
+  attributes.size = sizeof(attributes);
+  attributes.type = type;
+  attributes.config = config;
+  attributes.exclude_kernel = 1;
+  attributes.exclude_hv = 1;
+  return static_cast<int>(
+      ::syscall(SYS_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+}
+
+size_t read_perf_event(int fd) {
+  uint64_t value{0};
+  if (fd < 0 || ::read(fd, &value, sizeof(value)) != sizeof(value)) return 0;
+  return static_cast<size_t>(value);
+}
+}
+
+void thread::open_fault_counters() {
+  page_faults_fd_.store(open_perf_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS),
+                        std::memory_order_release);
+  dtlb_misses_fd_.store(
+      open_perf_event(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)),
+      std::memory_order_release);
+}
+
+void thread::add_stack_stats(stack_cache_stats& stats) const {
+  stack_cache_.add_stats(stats);
+  stats.nb_page_faults += read_perf_event(page_faults_fd_.load(std::memory_order_acquire));
+  stats.nb_dtlb_misses += read_perf_event(dtlb_misses_fd_.load(std::memory_order_acquire));
+}
+
 void thread::unregister_expired_slot(std::size_t slot_index) {
-  suspended_slots_.free(slot_index);
+  free_slot(slot_index);
 }
 
 thread::thread(engine& parent_engine)
     : engine_proxy_(parent_engine),
-      loop_(new event_loop{*this, static_cast<int>(parent_engine.max_nb_cores() + 1)}),
-      engine_queue_{}
+      stack_cache_{parent_engine.options()},
+      stack_profiler_{parent_engine.options().stack_sizing_samples},
+      stack_profiling_{parent_engine.options().stack_profiling ||
+                       parent_engine.options().auto_stack_sizing},
+      auto_stack_sizing_{parent_engine.options().auto_stack_sizing},
+      shared_stack_class_{parent_engine.options().shared_stack_class},
+      engine_queue_{},
+      scheduling_policy_{make_scheduling_policy(parent_engine.options())},
+      yield_quantum_ticks_{parent_engine.options().yield_quantum.count() *
+                           tsc_ticks_per_microsecond()},
+      spin_budget_ticks_{parent_engine.options().spin_before_park.count() *
+                         tsc_ticks_per_microsecond()},
+      max_spin_budget_ticks_{spin_budget_ticks_}
 {
-  engine_event_id_ = loop_->register_event(&engine_event_id_);
   engine_proxy_.set_id();  // Tells the engine which thread id we got
 }
 
-thread::~thread() {}
+void thread::prepare() {
+  current_thread() = this;
+  engine_proxy_.apply_affinity();
+  auto const& parent_engine = get_engine();
+  loop_.reset(new event_loop{*this, static_cast<int>(parent_engine.max_nb_cores() + 1)});
+  size_t ring_capacity = parent_engine.options().command_ring_capacity;
+  if (0 < ring_capacity) {
+    // One ring per thread plus one for the engine
+    command_rings_.reserve(parent_engine.max_nb_cores() + 1);
+    for (size_t index = 0; index < parent_engine.max_nb_cores() + 1; ++index)
+      command_rings_.emplace_back(new command_ring_t(ring_capacity));
+    nb_spilled_commands_.reset(new std::atomic<std::size_t>[command_rings_.size()]);
+    for (size_t index = 0; index < command_rings_.size(); ++index)
+      nb_spilled_commands_[index].store(0, std::memory_order_relaxed);
+  }
+  engine_event_id_ = loop_->register_event(&engine_event_id_);
+}
+
+thread::~thread() {
+  if (shared_stack_.sp) stack_cache_.put(shared_stack_);
+  if (0 <= page_faults_fd_) ::close(page_faults_fd_);
+  if (0 <= dtlb_misses_fd_) ::close(dtlb_misses_fd_);
+}
 
 void thread::event(int event_id, void* data, event_status status) {
   if (event_id == engine_event_id_) {
@@ -175,11 +471,13 @@ void thread::read(int fd, void* data, event_status status) {
   if (slot.ptr) {
     slot.ptr->get()->event_happened(slot.event_index, status);
   }
+  else if (wake_task(slot)) {
+    --nb_suspended_routines_;
+  }
   else {
     // Dry run, just disable the event
-    suspended_slots_.free(reinterpret_cast<std::size_t>(data));
   }
-    suspended_slots_.free(reinterpret_cast<std::size_t>(data));
+    free_slot(reinterpret_cast<std::size_t>(data));
   int existing_read = -1;
   tie(existing_read, std::ignore) = loop_->get_events(fd);
   if (0 <= existing_read)
@@ -191,116 +489,289 @@ void thread::write(int fd, void* data, event_status status) {
   if (slot.ptr) {
     slot.ptr->get()->event_happened(slot.event_index, status);
   }
+  else if (wake_task(slot)) {
+    --nb_suspended_routines_;
+  }
   else {
     // Dry run, just disable the event
   }
-    suspended_slots_.free(reinterpret_cast<std::size_t>(data));
+    free_slot(reinterpret_cast<std::size_t>(data));
   int existing_write= -1;
   tie(std::ignore, existing_write) = loop_->get_events(fd);
   if (0 <= existing_write)
     loop_->unregister(existing_write);
 }
 
+void thread::start_new_routine(routine_ptr_t new_routine) {
+  start_new_routine(get_engine().options().default_placement, std::move(new_routine));
+}
+
+void thread::start_new_routine(placement policy, routine_ptr_t new_routine) {
+  if (placement::local == policy)
+    start_new_routine(id(), std::move(new_routine));
+  else
+    engine_proxy_.start_routine(policy, std::move(new_routine));
+}
+
+void thread::start_new_routine(thread_id target_thread, routine_ptr_t new_routine) {
+  if (target_thread == id()) {
+    // Nothing to cross, it will run in the current scheduling round
+    scheduled_routines_.push_back(new_routine.release());
+  } else {
+    engine_proxy_.start_routine(target_thread, std::move(new_routine));
+  }
+}
+
+void thread::start_new_routines(placement policy, run_queue batch) {
+  if (placement::local == policy)
+    scheduled_routines_.splice_back(batch);
+  else
+    engine_proxy_.start_routines(policy, std::move(batch));
+}
+
+placement thread::default_placement() const {
+  return get_engine().options().default_placement;
+}
+
+void thread::migrate(routine_ptr_t migrating, thread_id target_thread) {
+  // Registrations of fds the routine waited for but did not get, the
+  // registration is stale if its slot has been invalidated. A task may
+  // have taken the registration over since, it is then kept.
+  for (auto& event : migrating->events_) {
+    if (event.type != event_type::io_read && event.type != event_type::io_write) continue;
+    int event_ids[2];
+    std::tie(event_ids[0], event_ids[1]) = loop_->get_events(event.data.get<routine_io_event>().fd);
+    for (int event_id : event_ids) {
+      if (event_id < 0) continue;
+      auto slot_index = reinterpret_cast<std::size_t>(loop_->get_data(event_id));
+      auto const& slot = suspended_slots_[slot_index];
+      if (!slot.ptr && !slot.task.resume) {
+        loop_->unregister(event_id);
+        free_slot(slot_index);
+      }
+    }
+  }
+  migrating->events_.clear();
+  // The reference count of the slots is not thread safe, let it here
+  migrating->current_ptr_ = nullptr;
+  engine_proxy_.start_routine(target_thread, std::move(migrating));
+}
+
+void thread::share_scheduled_routines() {
+  // Scheduled routines are either new or yielding, only pinned ones must stay
+  size_t nb_movable = 0;
+  for (routine* current = scheduled_routines_.front(); current;
+       current = current->next_scheduled_) {
+    if (!current->is_pinned()) ++nb_movable;
+  }
+
+  // Give away half of the movable routines, keep the rest in order
+  size_t nb_to_give = nb_movable / 2;
+  if (0 == nb_to_give) return;
+  thread_id target = engine_proxy_.claim_hungry_thread();
+  if (target == get_engine().max_nb_cores()) return;
+
+  run_queue kept_routines;
+  while (!scheduled_routines_.empty()) {
+    routine* current = scheduled_routines_.pop_front();
+    if (0 < nb_to_give && !current->is_pinned()) {
+      migrate(routine_ptr_t(current), target);
+      --nb_to_give;
+    } else {
+      kept_routines.push_back(current);
+    }
+  }
+  scheduled_routines_.swap(kept_routines);
+}
+
 // called by engine
-void thread::push_command(thread_id from, std::unique_ptr<thread_command> command) {
+void thread::push_command(thread_id from, thread_command command) {
   nb_pending_commands_.fetch_add(1);
-  //engine_queue_.write(from, command.release());
+  command.from = from;
+  if (from < command_rings_.size()) {
+    auto& nb_spilled = nb_spilled_commands_[from];
+    // A full ring leaves the command untouched, it then takes the slow path
+    if (0 == nb_spilled.load(std::memory_order_acquire) &&
+        command_rings_[from]->write(std::move(command))) {
+      wake_up();
+      return;
+    }
+    // Counted before being readable, the reader decrements it
+    nb_spilled.fetch_add(1, std::memory_order_relaxed);
+  }
   engine_queue_.write(std::move(command));
-  loop_->send_event(engine_event_id_);
+  wake_up();
 };
 
-bool thread::execute_scheduled_routines() {
-  decltype(scheduled_routines_) next_scheduled_routines;
-  std::deque<std::tuple<size_t, routine_ptr_t>> new_timed_routines_;
-  while (!scheduled_routines_.empty()) {
-    // For now; we schedule them in order
-    auto& slot = scheduled_routines_.front();
-    if (slot.ptr) {
-      auto routine = running_routine_ = slot.ptr->get();
-
-      bool run_routine = true;
-      // Try to get a semaphore ticket, if relevant
-      if (routine->status() == routine_status::sema_event_candidate) {
-        run_routine = routine->event_happened(slot.event_index);
-        // If success, get back the unique ownership of the routine
-        if (run_routine) {
-          slot.ptr = routine_local_ptr_t(routine_ptr_t(routine));
-        }
-      }
+void thread::wake_up() {
+  // A spinning thread sees the flag without the eventfd. Sequentially
+  // consistent so that either we see it spinning or it sees the flag.
+  if (wakeup_pending_.exchange(true) || spinning_.load()) {
+    nb_wakeups_saved_.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    nb_wakeups_sent_.fetch_add(1, std::memory_order_relaxed);
+    loop_->send_event(engine_event_id_);
+  }
+}
+
+bool thread::spin_for_work(int timeout_ms) {
+  bool busy_poll = get_engine().options().busy_poll;
+  if (!busy_poll && 0 == spin_budget_ticks_) return false;
 
-      if (run_routine) routine->resume(this);
-      switch (routine->status()) {
-        case routine_status::is_new:
-        case routine_status::running: {
-          // Not supposed to happen
-          assert(false);
-        } break;
-        case routine_status::yielding: {
-          // If not finished, then we reschedule it
-          next_scheduled_routines.emplace_back(
-              routine_slot{routine_local_ptr_t(routine_ptr_t(slot.ptr->release())), 0});
-        } break;
-        case routine_status::wait_events: {
-          slot.ptr->release();
-        } break;
-        case routine_status::sema_event_candidate: {
-          // Thats means no event happened for the routine, so we must let the slot pointer
-          // untouched for other events to stay valid
-          routine->status_ = routine_status::wait_events;
-        } break;
-        case routine_status::finished: {
-          // Should have been made by the routine by closing the FD
-        } break;
-      };
-
-      // if (routine.get()) {
-      // debug::log("Routine {}:{}:{} will be deleted.", id(), routine->id(),
-      // static_cast<int>(routine->status()));
-      //}
+  static constexpr size_t poll_period = 64;
+  uint64_t start = read_tsc();
+  uint64_t budget = busy_poll ? std::numeric_limits<uint64_t>::max() : spin_budget_ticks_;
+  if (0 <= timeout_ms) {
+    budget = std::min<uint64_t>(
+        budget, static_cast<uint64_t>(timeout_ms) * 1000 * tsc_ticks_per_microsecond());
+  }
+
+  bool found_work = false;
+  spinning_.store(true);
+  for (size_t iteration = 1; !found_work && read_tsc() - start < budget; ++iteration) {
+    if (wakeup_pending_.load()) {
+      found_work = true;
+    } else if (0 == iteration % poll_period) {
+      // Non blocking, without syscall if no fd is registered
+      loop_->loop(1, 0);
+      found_work = !scheduled_routines_.empty() || !local_commands_.empty() ||
+                   !semaphore_candidates_.empty() || !ready_tasks_.empty();
+    } else {
+      cpu_relax();
     }
-    scheduled_routines_.pop_front();
+  }
+  spinning_.store(false);
+  // A sender may have skipped the eventfd while we were spinning
+  if (wakeup_pending_.load()) {
+    handle_engine_event();
+    found_work = true;
+  }
+
+  if (!busy_poll) {
+    spin_budget_ticks_ = found_work
+                             ? std::min(max_spin_budget_ticks_, 2 * spin_budget_ticks_)
+                             : std::max(max_spin_budget_ticks_ / 16, spin_budget_ticks_ / 2);
+  }
+  return found_work;
+}
+
+bool thread::should_yield() {
+  uint64_t now = read_tsc();
+  if (now - slice_start_ < yield_quantum_ticks_) return false;
+  slice_start_ = now;
+  return !scheduled_routines_.empty() || !next_scheduled_routines_.empty() ||
+         !ready_tasks_.empty() ||
+         !local_commands_.empty() || 0 < nb_pending_commands_.load(std::memory_order_relaxed) ||
+         (0 < nb_suspended_routines_ && loop_->has_pending_events()) ||
+         (!timers_.empty() &&
+          timers_.front().date <= std::chrono::high_resolution_clock::now());
+}
+
+bool thread::submit_blocking(std::function<void()> call, std::function<void()> notify) {
+  return engine_proxy_.submit_blocking(std::move(call), std::move(notify));
+}
+
+void thread::run_ready_tasks() {
+  // Tasks woken up meanwhile run in the next round
+  running_tasks_.swap(ready_tasks_);
+  for (auto& task : running_tasks_) task.resume(task.frame);
+  running_tasks_.clear();
+}
+
+bool thread::execute_scheduled_routines() {
+  // Wake ups made by event handlers
+  execute_local_commands();
+
+  // Stackless tasks run before the routines of the round
+  if (!ready_tasks_.empty()) {
+    run_ready_tasks();
+    execute_local_commands();
   }
 
+  // An ordered round runs as prepared, routines arriving meanwhile wait for the next one
+  size_t nb_in_round = scheduled_routines_.size();
+  if (scheduling_policy_) {
+    scheduling_policy_->prepare_round(scheduled_routines_, next_scheduled_routines_);
+    nb_in_round = scheduled_routines_.size();
+  }
+  while (!scheduled_routines_.empty() && (!scheduling_policy_ || 0 < nb_in_round--)) {
+    // The queue owns the routine until it is suspended
+    auto routine = running_routine_ = scheduled_routines_.pop_front();
+    slice_start_ = read_tsc();
+    routine->resume(this);
+    switch (routine->status()) {
+      case routine_status::is_new:
+      case routine_status::running:
+      case routine_status::sema_event_candidate: {
+        // Not supposed to happen
+        assert(false);
+      } break;
+      case routine_status::yielding: {
+        // If not finished, then we reschedule it, in place
+        next_scheduled_routines_.push_back(routine);
+      } break;
+      case routine_status::wait_events: {
+        // Now owned by its event registrations
+      } break;
+      case routine_status::migrating: {
+        routine->status_ = routine_status::yielding;
+        migrate(routine_ptr_t(routine), routine->migration_target_);
+      } break;
+      case routine_status::finished: {
+        // Should have been made by the routine by closing the FD
+        delete routine;
+      } break;
+    };
+
+    // Wake ups made by the routine, now that it is suspended
+    execute_local_commands();
+  }
+
+  // Routines arrived during an ordered round
+  next_scheduled_routines_.splice_back(scheduled_routines_);
+
   // Yielded routines are immediately scheduled
-  scheduled_routines_ = std::move(next_scheduled_routines);
+  scheduled_routines_.swap(next_scheduled_routines_);
+
+  // Feed idle threads if asked to
+  bool work_stealing = get_engine().options().work_stealing;
+  if (work_stealing) {
+    if (1 < scheduled_routines_.size() && engine_proxy_.has_hungry_threads())
+      share_scheduled_routines();
+    engine_proxy_.set_hungry(scheduled_routines_.empty());
+  }
 
   // Cleanup canceled timers
-  auto first_timed_routines = begin(timed_routines_);
-  while (first_timed_routines != end(timed_routines_) && first_timed_routines->second.nb_active == 0) {
-    // Clean up suspended vector
-    for (auto index : first_timed_routines->second.slots)
-      suspended_slots_.free(index);
-    // Delete full record
-    first_timed_routines = timed_routines_.erase(first_timed_routines);
-  }
+  clean_canceled_timers();
 
   // If finished and no more routines, exit
   size_t nb_pending_commands = nb_pending_commands_;
-  bool no_more_routines =
-      scheduled_routines_.empty() && timed_routines_.empty() && 0 == nb_suspended_routines_;
+  bool no_more_routines = scheduled_routines_.empty() && ready_tasks_.empty() &&
+                          timers_.empty() && 0 == nb_suspended_routines_;
   if (no_more_routines) {
     if (0 == nb_pending_commands) {
         if (thread_status::finishing == status_) {
+          if (work_stealing) engine_proxy_.set_hungry(false);
           unregister_all_events();
           status_ = thread_status::finished;
           return false;
         }
         else {
-          engine_proxy_.notify_idle(0);
+          engine_proxy_.notify_idle(nb_received_routines_);
           return false;
         }
     }
   } else {
-    if (scheduled_routines_.empty()) {
-      size_t nb_routines = timed_routines_.size() + nb_suspended_routines_;
+    if (scheduled_routines_.empty() && ready_tasks_.empty()) {
+      size_t nb_routines = timers_.size() + nb_suspended_routines_;
       if (0 == nb_pending_commands) {
         if (0 == nb_routines) {
-            engine_proxy_.notify_idle(0);
+            engine_proxy_.notify_idle(nb_received_routines_);
         }
         return false;
       } else {
         // Schedule pending commands immediately
-        loop_->send_event(engine_event_id_);
+        wake_up();
         return true;
       }
     } else {
@@ -313,7 +784,7 @@ bool thread::execute_scheduled_routines() {
 
 void thread::loop() {
   using namespace std::chrono;
-  current_thread() = this;
+  if (get_engine().options().stack_fault_counters) open_fault_counters();
 
   // Check if we should have a time out
   int timeout_ms = -1;
@@ -322,21 +793,31 @@ void thread::loop() {
 
     // Compute next timeout
     bool fire_timed_out_routines = false;
-    auto first_timed_routines = begin(timed_routines_);
-    if (0 != timeout_ms) {
-      if (first_timed_routines != end(timed_routines_)) {
-        // Compute next timeout
-        timeout_ms =
-            duration_cast<milliseconds>(first_timed_routines->first - high_resolution_clock::now())
-                .count();
-        if (timeout_ms < 0)
-          timeout_ms = 0;
-        if (timeout_ms == 0)
-          fire_timed_out_routines = true;
+    if (!timers_.empty()) {
+      // Checked even if routines are runnable, so that busy threads still fire timers
+      int timer_ms =
+          duration_cast<milliseconds>(timers_.front().date - high_resolution_clock::now())
+              .count();
+      if (timer_ms <= 0) {
+        timeout_ms = 0;
+        fire_timed_out_routines = true;
+      } else if (0 != timeout_ms) {
+        timeout_ms = timer_ms;
       }
     }
 
+    auto wait_start = steady_clock::now();
+    if (0 != timeout_ms) {
+      if (spin_for_work(timeout_ms)) {
+        timeout_ms = 0;
+      } else if (0 < timeout_ms) {
+        // Only wait for what is left until the next timer
+        int spent_ms = duration_cast<milliseconds>(steady_clock::now() - wait_start).count();
+        timeout_ms = std::max(0, timeout_ms - spent_ms);
+      }
+    }
     auto return_code = loop_->loop(1, timeout_ms);
+    auto busy_start = steady_clock::now();
     switch (return_code) {
       case loop_end_reason::max_iter_reached:
         break;
@@ -350,15 +831,20 @@ void thread::loop() {
     }
     if (fire_timed_out_routines) {
       // Schedule routines that timed out
-      for (auto& timed_routine : first_timed_routines->second.slots) {
-        auto& slot =  suspended_slots_[timed_routine];
-        if (slot.ptr)
-          slot.ptr->get()->event_happened(slot.event_index);
-        suspended_slots_.free(timed_routine);
-      }
-      timed_routines_.erase(first_timed_routines);
+      fire_timers();
     }
     timeout_ms = execute_scheduled_routines() ? 0 : -1;
+
+    // Update the load seen by the engine
+    auto busy_end = steady_clock::now();
+    auto total_time = (busy_end - wait_start).count();
+    if (0 < total_time) {
+      size_t ratio = busy_ratio_scale * (busy_end - busy_start).count() / total_time;
+      busy_ratio_ = (7 * busy_ratio_ + ratio) / 8;
+    }
+    engine_proxy_.publish_load(
+        scheduled_routines_.size() + timers_.size() + nb_suspended_routines_,
+        scheduled_routines_.size(), nb_received_routines_, busy_ratio_);
   }
 
   engine_proxy_.notify_end();
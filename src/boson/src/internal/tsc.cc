@@ -0,0 +1,29 @@
+#include "internal/tsc.h"
+
+namespace boson {
+namespace internal {
+
+namespace {
+uint64_t measure_ticks_per_microsecond() {
+  using namespace std::chrono;
+  // Short enough not to delay startup, long enough for a percent precision
+  auto start_time = steady_clock::now();
+  uint64_t start_ticks = read_tsc();
+  auto end_time = start_time;
+  do {
+    end_time = steady_clock::now();
+  } while (end_time - start_time < microseconds(200));
+  uint64_t elapsed_ticks = read_tsc() - start_ticks;
+  uint64_t elapsed_us = duration_cast<microseconds>(end_time - start_time).count();
+  uint64_t ticks = elapsed_ticks / (0 < elapsed_us ? elapsed_us : 1);
+  return 0 < ticks ? ticks : 1;
+}
+}
+
+uint64_t tsc_ticks_per_microsecond() {
+  static uint64_t const ticks = measure_ticks_per_microsecond();
+  return ticks;
+}
+
+}  // namespace internal
+}  // namespace boson
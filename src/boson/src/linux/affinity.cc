@@ -0,0 +1,55 @@
+#include "affinity.h"
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <climits>
+
+namespace boson {
+namespace internal {
+
+namespace {
+// From linux/mempolicy.h, not included to avoid requiring kernel headers
+constexpr int mpol_preferred = 1;
+constexpr int max_numa_nodes = 1024;
+constexpr int node_mask_bits = sizeof(unsigned long) * CHAR_BIT;
+}
+
+bool is_cpu_allowed(int cpu) {
+  if (cpu < 0 || CPU_SETSIZE <= cpu) return false;
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return false;
+  return CPU_ISSET(cpu, &allowed);
+}
+
+bool pin_current_thread(int cpu) {
+  if (cpu < 0 || CPU_SETSIZE <= cpu) return false;
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  return ::sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+}
+
+int current_numa_node() {
+#ifdef SYS_getcpu
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (::syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) return static_cast<int>(node);
+#endif
+  return -1;
+}
+
+bool prefer_numa_node(int node) {
+#ifdef SYS_set_mempolicy
+  if (node < 0 || max_numa_nodes <= node) return false;
+  unsigned long mask[max_numa_nodes / node_mask_bits] = {};
+  mask[node / node_mask_bits] = 1ul << (node % node_mask_bits);
+  // Fails with ENOSYS on kernels built without NUMA support
+  return ::syscall(SYS_set_mempolicy, mpol_preferred, mask, max_numa_nodes + 1) == 0;
+#else
+  return false;
+#endif
+}
+
+}  // namespace internal
+}  // namespace boson
@@ -0,0 +1,40 @@
+/***
+ * Thread placement on CPUs and NUMA nodes
+ *
+ * Raw system calls are used so that libnuma is not required. Every
+ * function fails gracefully if the kernel does not support NUMA.
+ */
+#ifndef BOSON_AFFINITY_H_
+#define BOSON_AFFINITY_H_
+#pragma once
+
+namespace boson {
+namespace internal {
+
+/**
+ * Tells if the calling thread is allowed to run on the given CPU
+ */
+bool is_cpu_allowed(int cpu);
+
+/**
+ * Restricts the calling thread to the given CPU
+ */
+bool pin_current_thread(int cpu);
+
+/**
+ * Returns the NUMA node the calling thread runs on, or -1 if unknown
+ */
+int current_numa_node();
+
+/**
+ * Makes the memory allocated by the calling thread come from the given node
+ *
+ * Memory already touched is not moved. The policy is only a preference, the
+ * kernel falls back to other nodes if the local one is full.
+ */
+bool prefer_numa_node(int node);
+
+}  // namespace internal
+}  // namespace boson
+
+#endif  // BOSON_AFFINITY_H_
@@ -1,4 +1,5 @@
 #include "event_loop_impl.h"
+#include <poll.h>
 #include <sys/eventfd.h>
 #include <unistd.h>
 #include <cassert>
@@ -220,6 +221,14 @@ void event_loop::send_fd_panic(int proc_from,int fd) {
   send_event(loop_breaker_event_);
 }
 
+bool event_loop::has_pending_events() {
+  if (trigger_fd_events_.load(std::memory_order_acquire)) return true;
+  if (0 == nb_io_registered_) return false;
+  // The epoll fd reads as ready while it holds events, polling it consumes none
+  struct pollfd loop_poll{loop_fd_, POLLIN, 0};
+  return 0 < ::poll(&loop_poll, 1, 0);
+}
+
 loop_end_reason event_loop::loop(int max_iter, int timeout_ms) {
   bool forever = (-1 == max_iter);
   bool retry = false;
@@ -116,6 +116,7 @@ class event_loop {
   void enable(int event_it);
   void* unregister(int event_id);
   void send_fd_panic(int proc_from, int fd);
+  bool has_pending_events();
   loop_end_reason loop(int max_iter = -1, int timeout_ms = -1);
 };
 }
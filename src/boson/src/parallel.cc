@@ -0,0 +1,41 @@
+#include "boson/parallel.h"
+#include <algorithm>
+
+namespace boson {
+namespace internal {
+
+parallel_range::parallel_range(std::size_t begin, std::size_t end, std::size_t grain,
+                               std::size_t nb_helpers)
+    : next_{begin}, end_{end}, grain_{grain}, nb_helpers_{std::max<std::size_t>(1, nb_helpers)} {
+  // By default, about 64 chunks per helper for the last ones
+  if (0 == grain_) grain_ = std::max<std::size_t>(1, (end - begin) / (64 * nb_helpers_));
+}
+
+bool parallel_range::claim(std::size_t& first, std::size_t& last) {
+  std::size_t current = next_.load(std::memory_order_relaxed);
+  while (current < end_) {
+    std::size_t remaining = end_ - current;
+    // Guided: a share of what is left, never below the grain
+    std::size_t size = std::min(remaining, std::max(grain_, remaining / (2 * nb_helpers_)));
+    if (next_.compare_exchange_weak(current, current + size, std::memory_order_relaxed)) {
+      first = current;
+      last = current + size;
+      return true;
+    }
+  }
+  return false;
+}
+
+void parallel_range::fail(std::exception_ptr error) {
+  std::lock_guard<std::mutex> guard(error_lock_);
+  if (!error_) error_ = error;
+  next_.store(end_, std::memory_order_relaxed);
+}
+
+void parallel_range::rethrow_if_failed() {
+  std::lock_guard<std::mutex> guard(error_lock_);
+  if (error_) std::rethrow_exception(error_);
+}
+
+}  // namespace internal
+}  // namespace boson
@@ -1,33 +1,85 @@
 #include "boson/semaphore.h"
+#include <array>
 #include <cassert>
+#include <cstdint>
+#include <unordered_map>
 #include "boson/engine.h"
 
 using namespace std::chrono;
 
 namespace boson {
 
+namespace {
+/**
+ * Live semaphores, so that commands naming a destroyed one are dropped
+ *
+ * Sharded by address to keep semaphore creations from contending.
+ */
+class semaphore_registry {
+ public:
+  struct shard {
+    std::mutex lock;
+    std::unordered_map<semaphore const*, std::uint64_t> ids;
+  };
+
+  static constexpr std::size_t nb_shards = 64;
+
+  shard& of(semaphore const* sema) {
+    return shards_[(reinterpret_cast<std::uintptr_t>(sema) / alignof(semaphore)) % nb_shards];
+  }
+
+ private:
+  std::array<shard, nb_shards> shards_;
+};
+
+// Never destroyed, semaphores may outlive static destruction
+semaphore_registry& registry() {
+  static semaphore_registry* instance = new semaphore_registry;
+  return *instance;
+}
+
+std::atomic<std::uint64_t> next_semaphore_id{1};
+}  // namespace
+
 semaphore::semaphore(int capacity)
-    : counter_{capacity} {
+    : counter_{capacity}, id_{next_semaphore_id.fetch_add(1, std::memory_order_relaxed)} {
+  auto& shard = registry().of(this);
+  std::lock_guard<std::mutex> guard(shard.lock);
+  shard.ids[this] = id_;
 }
 
 semaphore::~semaphore() {
+  {
+    auto& shard = registry().of(this);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    shard.ids.erase(this);
+  }
   // Clean up stale events
   std::pair<internal::thread*,std::size_t> waiter;
   //auto current_thread_id = internal::current_thread()->id();
   while(waiters_.read(waiter));
 }
 
+void semaphore::pop_a_waiter(internal::semaphore_handle handle, internal::thread* current) {
+  auto& shard = registry().of(handle.sema);
+  std::lock_guard<std::mutex> guard(shard.lock);
+  auto found = shard.ids.find(handle.sema);
+  if (found != shard.ids.end() && found->second == handle.id) handle.sema->pop_a_waiter(current);
+}
+
 bool semaphore::pop_a_waiter(internal::thread* current) {
   using namespace internal;
   int result = 1;
   if(0 < result) {
     waiting_unit_t waiter;
-    if (read(waiter)) {
+    if (read(waiter, current)) {
       thread* managing_thread = waiter.first;
-      managing_thread->push_command(
-          current->id(), std::make_unique<thread_command>(
-                             thread_command_type::schedule_waiting_routine,
-                             std::make_pair(this->shared_from_this(),waiter.second)));
+      auto command = thread_command::schedule_waiting_routine(handle(), waiter.second);
+      if (managing_thread == current)
+        current->push_local_command(std::move(command));
+      else
+        managing_thread->push_command(current ? current->id() : foreign_thread_id,
+                                      std::move(command));
       return true;
     }
   }
@@ -44,6 +96,26 @@ bool semaphore::read(waiting_unit_t& waiter) {
   return waiters_.read(waiter);
 }
 
+bool semaphore::read(waiting_unit_t& waiter, internal::thread* preferred_thread) {
+  std::lock_guard<std::mutex> guard(waiters_lock_);
+  if (preferred_thread && nb_head_bypasses_ < max_head_bypasses) {
+    std::size_t rank =
+        waiters_.read_within(waiter, local_waiter_window, [preferred_thread](auto const& unit) {
+          return unit.first == preferred_thread;
+        });
+    if (rank == 0) {
+      nb_head_bypasses_ = 0;
+      return true;
+    }
+    if (rank < local_waiter_window) {
+      ++nb_head_bypasses_;
+      return true;
+    }
+  }
+  nb_head_bypasses_ = 0;
+  return waiters_.read(waiter);
+}
+
 bool semaphore::free(size_t index) {
   std::lock_guard<std::mutex> guard(waiters_lock_);
   return waiters_.lazy_free(index);
@@ -53,13 +125,15 @@ void semaphore::disable() {
   using namespace internal;
   counter_.store(disabled_standpoint, std::memory_order_release);
   waiting_unit_t waiter;
-  auto current_thread_id = current_thread()->id();
+  thread* current = current_thread();
   while (read(waiter)) {
     thread* managing_thread = waiter.first;
-    managing_thread->push_command(
-        current_thread_id,
-        std::make_unique<thread_command>(thread_command_type::schedule_waiting_routine,
-                                         std::make_pair(this->shared_from_this(), waiter.second)));
+    auto command = thread_command::schedule_waiting_routine(handle(), waiter.second);
+    if (managing_thread == current)
+      current->push_local_command(std::move(command));
+    else
+      managing_thread->push_command(current ? current->id() : foreign_thread_id,
+                                    std::move(command));
   }
 }
 
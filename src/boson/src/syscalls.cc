@@ -1,4 +1,5 @@
 #include "boson/syscalls.h"
+#include "boson/engine.h"
 #include "boson/internal/routine.h"
 #include "boson/internal/thread.h"
 
@@ -10,11 +11,36 @@ void yield() {
   thread* this_thread = current_thread();
   routine* current_routine = this_thread->running_routine();
   current_routine->status_ = routine_status::yielding;
-  this_thread->context() = jump_fcontext(this_thread->context().fctx, nullptr);
+  transfer_t thread_context = jump_fcontext(this_thread->context().fctx, nullptr);
+  // A yielding routine can be resumed by another thread
+  current_routine->thread_->context() = thread_context;
   current_routine->previous_status_ = routine_status::yielding;
   current_routine->status_ = routine_status::running;
 }
 
+bool maybe_yield() {
+  if (!current_thread()->should_yield()) return false;
+  yield();
+  return true;
+}
+
+bool migrate_to(std::size_t target_thread) {
+  thread* this_thread = current_thread();
+  if (this_thread->get_engine().max_nb_cores() <= target_thread) return false;
+  routine* current_routine = this_thread->running_routine();
+  // Its saved stack is only valid at the address of its thread shared stack
+  if (current_routine->schedule().shared_stack) return target_thread == this_thread->id();
+  current_routine->pin();
+  if (target_thread == this_thread->id()) return true;
+  current_routine->migration_target_ = target_thread;
+  current_routine->status_ = routine_status::migrating;
+  transfer_t thread_context = jump_fcontext(this_thread->context().fctx, nullptr);
+  current_routine->thread_->context() = thread_context;
+  current_routine->previous_status_ = routine_status::yielding;
+  current_routine->status_ = routine_status::running;
+  return true;
+}
+
 void sleep(std::chrono::milliseconds duration) {
   // Compute the time in ms
   using namespace std::chrono;
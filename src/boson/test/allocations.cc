@@ -0,0 +1,114 @@
+#include "catch.hpp"
+#include "boson/boson.h"
+#include "boson/semaphore.h"
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <unistd.h>
+#include "boson/logger.h"
+
+using namespace boson;
+using namespace std::literals;
+
+namespace {
+std::atomic<bool> counting{false};
+std::atomic<size_t> nb_allocations{0};
+
+// Runs the function a few times to warm up the containers, then counts
+template <class Function>
+size_t count_allocations(size_t nb_iterations, Function&& function) {
+  for (size_t index = 0; index < 1000; ++index) function();
+  nb_allocations = 0;
+  counting = true;
+  for (size_t index = 0; index < nb_iterations; ++index) function();
+  counting = false;
+  return nb_allocations;
+}
+}
+
+// Every thread of the test binary goes through these
+void* operator new(std::size_t size) {
+  if (counting.load(std::memory_order_relaxed)) ++nb_allocations;
+  void* pointer = std::malloc(size ? size : 1);
+  if (!pointer) throw std::bad_alloc();
+  return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+
+TEST_CASE("Allocations - Event rounds", "[allocations]") {
+  boson::debug::logger_instance(&std::cout);
+
+  static constexpr size_t nb_waits = 300000;
+  int pipe_fds[2];
+  REQUIRE(0 == ::pipe(pipe_fds));
+
+  size_t nb_sleep_allocations = 1;
+  size_t nb_readiness_allocations = 1;
+  size_t nb_semaphore_allocations = 1;
+  boson::run(1, [&]() {
+    nb_sleep_allocations = count_allocations(nb_waits, []() { boson::sleep(0ms); });
+
+    // The write end of an empty pipe is always ready
+    nb_readiness_allocations = count_allocations(
+        nb_waits, [&]() { boson::wait_write_readiness(pipe_fds[1], -1); });
+
+    // Ping pong between two routines
+    shared_semaphore ping(0);
+    shared_semaphore pong(0);
+    start([](shared_semaphore ping, shared_semaphore pong) {
+      for (size_t index = 0; index < 1000 + nb_waits; ++index) {
+        ping.wait();
+        pong.post();
+      }
+    }, ping, pong);
+    nb_semaphore_allocations = count_allocations(nb_waits, [&]() {
+      ping.post();
+      pong.wait();
+    });
+  });
+  ::close(pipe_fds[0]);
+  ::close(pipe_fds[1]);
+
+  CHECK(nb_sleep_allocations == 0);
+  CHECK(nb_readiness_allocations == 0);
+  CHECK(nb_semaphore_allocations == 0);
+}
+
+TEST_CASE("Allocations - Spawns", "[allocations]") {
+  boson::debug::logger_instance(&std::cout);
+
+  static constexpr size_t nb_spawns = 100000;
+  engine_options options;
+  options.default_placement = placement::local;
+  options.stack_cache_size = 4;
+
+  size_t nb_small_allocations = 0;
+  size_t nb_large_allocations = 0;
+  boson::run(1, options, [&]() {
+    size_t nb_done = 0;
+    // Only the routine itself is allocated
+    nb_small_allocations = count_allocations(nb_spawns, [&]() {
+      start([](size_t* nb_done) { ++*nb_done; }, &nb_done);
+      boson::yield();
+    });
+
+    // Functions too big to be inline go to the heap
+    std::array<char, 128> payload{};
+    nb_large_allocations = count_allocations(nb_spawns, [&]() {
+      start([payload](size_t* nb_done) { *nb_done += payload.size(); }, &nb_done);
+      boson::yield();
+    });
+  });
+
+  CHECK(nb_small_allocations == nb_spawns);
+  CHECK(nb_large_allocations == 2 * nb_spawns);
+}
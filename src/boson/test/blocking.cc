@@ -0,0 +1,71 @@
+#include "catch.hpp"
+#include "boson/boson.h"
+#include "boson/blocking.h"
+#include <unistd.h>
+#include <iostream>
+#include <stdexcept>
+#include "boson/logger.h"
+
+using namespace boson;
+using namespace std::literals;
+
+TEST_CASE("Blocking - Offloaded calls", "[blocking]") {
+  boson::debug::logger_instance(&std::cout);
+
+  SECTION("Thread keeps running") {
+    int result = 0;
+    int nb_ticks = 0;
+    bool done = false;
+    blocking_pool_stats stats{};
+    boson::run(1, [&]() {
+      start([&]() {
+        while (!done) {
+          ++nb_ticks;
+          boson::sleep(1ms);
+        }
+      });
+      result = blocking([]() {
+        ::usleep(50000);
+        return 42;
+      });
+      done = true;
+      stats = blocking_stats();
+    });
+    CHECK(result == 42);
+    CHECK(5 < nb_ticks);
+    CHECK(stats.nb_submitted == 1);
+    CHECK(stats.nb_completed == 1);
+    CHECK(stats.nb_running == 0);
+  }
+
+  SECTION("Exceptions") {
+    bool caught = false;
+    boson::run(1, [&]() {
+      try {
+        blocking([]() { throw std::runtime_error("failed"); });
+      } catch (std::runtime_error const&) {
+        caught = true;
+      }
+    });
+    CHECK(caught);
+  }
+
+  SECTION("Full queue") {
+    engine_options options;
+    options.blocking_pool_size = 1;
+    options.blocking_queue_depth = 1;
+    std::atomic<int> nb_done{0};
+    blocking_pool_stats stats{};
+    boson::run(2, options, [&]() {
+      for (int index = 0; index < 4; ++index) {
+        start([&]() {
+          blocking([]() { ::usleep(5000); });
+          if (++nb_done == 4) stats = blocking_stats();
+        });
+      }
+    });
+    CHECK(nb_done == 4);
+    CHECK(stats.nb_completed == 4);
+    CHECK(0 < stats.nb_rejected);
+  }
+}
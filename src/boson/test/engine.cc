@@ -0,0 +1,839 @@
+#include "catch.hpp"
+#include "boson/boson.h"
+#include "boson/channel.h"
+#include "boson/exception.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "boson/logger.h"
+
+using namespace boson;
+using namespace std::literals;
+
+TEST_CASE("Engine - Work stealing", "[engine][stealing]") {
+  boson::debug::logger_instance(&std::cout);
+
+  engine_options options;
+  options.work_stealing = true;
+
+  std::atomic<bool> migrated{false};
+  std::atomic<bool> pinned_migrated{false};
+
+  boson::run(2, options, [&]() {
+    // Round robin places the init routine on thread 0, then alternates
+    for (int index = 0; index < 8; ++index) {
+      start([&](bool busy) {
+        if (!busy) return;
+        auto started_on = internal::current_thread()->id();
+        auto deadline = std::chrono::steady_clock::now() + 1s;
+        while (!migrated && std::chrono::steady_clock::now() < deadline) {
+          boson::yield();
+          if (internal::current_thread()->id() != started_on) migrated = true;
+        }
+      }, index % 2 == 1);
+    }
+
+    // Explicitly placed routines never move
+    start_explicit(0, [&]() {
+      for (int index = 0; index < 100; ++index) {
+        boson::yield();
+        if (internal::current_thread()->id() != 0) pinned_migrated = true;
+      }
+    });
+  });
+
+  CHECK(migrated);
+  CHECK_FALSE(pinned_migrated);
+}
+
+TEST_CASE("Engine - Placement", "[engine][placement]") {
+  boson::debug::logger_instance(&std::cout);
+
+  SECTION("Local placement") {
+    std::atomic<bool> all_local{true};
+    boson::run(3, [&]() {
+      for (thread_id id = 0; id < 3; ++id) {
+        start_explicit(id, [&](thread_id parent) {
+          start(placement::local, [&](thread_id expected) {
+            if (internal::current_thread()->id() != expected) all_local = false;
+          }, parent);
+        }, id);
+      }
+    });
+    CHECK(all_local);
+  }
+
+  SECTION("Least loaded placement") {
+    std::atomic<int> on_busy_thread{0};
+    std::atomic<int> on_idle_thread{0};
+    boson::run(2, [&]() {
+      // Keep thread 0 busy until every placed routine ran
+      start_explicit(0, [&]() {
+        while (on_busy_thread + on_idle_thread < 4) boson::yield();
+      });
+      for (int index = 0; index < 10; ++index) boson::yield();
+      for (int index = 0; index < 4; ++index) {
+        start(placement::least_loaded, [&]() {
+          ++(internal::current_thread()->id() == 0 ? on_busy_thread : on_idle_thread);
+        });
+      }
+    });
+    CHECK(on_busy_thread < on_idle_thread);
+  }
+}
+
+TEST_CASE("Engine - Direct spawning", "[engine][spawn]") {
+  boson::debug::logger_instance(&std::cout);
+
+  std::mutex ids_lock;
+  std::set<routine_id> ids;
+  std::atomic<int> nb_misplaced{0};
+
+  boson::run(3, [&]() {
+    for (thread_id id = 0; id < 3; ++id) {
+      start_explicit(id, [&](thread_id parent) {
+        for (int index = 0; index < 100; ++index) {
+          start_explicit((parent + 1) % 3, [&](thread_id expected) {
+            if (internal::current_thread()->id() != expected) ++nb_misplaced;
+            std::lock_guard<std::mutex> guard(ids_lock);
+            ids.insert(internal::current_thread()->running_routine()->id());
+          }, (parent + 1) % 3);
+        }
+      }, id);
+    }
+  });
+
+  CHECK(ids.size() == 300);
+  CHECK(nb_misplaced == 0);
+}
+
+TEST_CASE("Engine - Batch spawning", "[engine][spawn]") {
+  boson::debug::logger_instance(&std::cout);
+
+  std::atomic<int> sum{0};
+  std::atomic<int> per_thread[3] = {{0}, {0}, {0}};
+
+  SECTION("Range") {
+    std::vector<int> values(3000);
+    for (int index = 0; index < 3000; ++index) values[index] = index;
+    boson::run(3, [&]() {
+      start_batch(values, [&](int value) {
+        sum += value;
+        ++per_thread[internal::current_thread()->id()];
+      });
+    });
+    CHECK(sum == 2999 * 3000 / 2);
+    // One chunk per thread
+    for (auto& count : per_thread) CHECK(count == 1000);
+  }
+
+  SECTION("Generator") {
+    boson::run(3, [&]() {
+      start_batch_n(placement::local, 100, [&](size_t index) {
+        return [&, index]() {
+          sum += index;
+          ++per_thread[internal::current_thread()->id()];
+        };
+      });
+    });
+    CHECK(sum == 99 * 100 / 2);
+    CHECK(per_thread[0] == 100);
+  }
+}
+
+namespace {
+void hop(std::atomic<int>& nb_hops, int remaining) {
+  ++nb_hops;
+  boson::yield();
+  if (0 < remaining)
+    start_explicit((internal::current_thread()->id() + 1) % 3, hop, nb_hops, remaining - 1);
+}
+}
+
+TEST_CASE("Engine - Quiescence", "[engine][quiescence]") {
+  boson::debug::logger_instance(&std::cout);
+
+  // Each thread goes idle between hops, the engine must wait for the whole chain
+  std::atomic<int> nb_hops{0};
+  boson::run(3, [&]() {
+    start(hop, nb_hops, 49);
+  });
+  CHECK(nb_hops == 50);
+}
+
+TEST_CASE("Engine - Command rings", "[engine][rings]") {
+  boson::debug::logger_instance(&std::cout);
+
+  // A tiny capacity forces overflows into the unbounded queue
+  engine_options options;
+  options.command_ring_capacity = 2;
+
+  std::atomic<int> nb_hops{0};
+  std::atomic<int> sum{0};
+  // Only touched by thread 1
+  std::vector<int> arrivals;
+  boson::run(3, options, [&]() {
+    // Commands of a sender keep their order, overflowed or not
+    start_explicit(0, [&]() {
+      for (int index = 0; index < 1000; ++index)
+        start_explicit(1, [&arrivals](int value) { arrivals.push_back(value); }, index);
+    });
+    channel<int, 1> numbers;
+    start_explicit(1, [&](channel<int, 1> input) {
+      int value = 0;
+      while (input >> value) sum += value;
+    }, numbers);
+    start_explicit(2, [&](channel<int, 1> output) {
+      for (int index = 1; index <= 1000; ++index) output << index;
+      output.close();
+    }, numbers);
+    for (thread_id id = 0; id < 3; ++id) start_explicit(id, hop, nb_hops, 29);
+  });
+  CHECK(sum == 500500);
+  CHECK(nb_hops == 90);
+  REQUIRE(arrivals.size() == 1000);
+  CHECK(std::is_sorted(arrivals.begin(), arrivals.end()));
+}
+
+TEST_CASE("Engine - Coalesced wake ups", "[engine][wakeup]") {
+  boson::debug::logger_instance(&std::cout);
+
+  std::atomic<int> nb_started{0};
+  std::atomic<size_t> nb_sent{0};
+  std::atomic<size_t> nb_saved{0};
+  boson::run(2, [&]() {
+    start_explicit(0, [&]() {
+      // Commands pile up while thread 1 has not handled the first signal
+      for (int index = 0; index < 1000; ++index) {
+        start_explicit(1, [&]() { ++nb_started; });
+      }
+      start_explicit(1, [&]() {
+        nb_sent = internal::current_thread()->nb_wakeups_sent();
+        nb_saved = internal::current_thread()->nb_wakeups_saved();
+      });
+    });
+  });
+  CHECK(nb_started == 1000);
+  CHECK(1001 <= nb_sent + nb_saved);
+  CHECK(0 < nb_saved);
+}
+
+TEST_CASE("Engine - CPU affinity", "[engine][affinity]") {
+  boson::debug::logger_instance(&std::cout);
+
+  SECTION("Pinned threads") {
+    // The first CPU we may run on, cpusets may exclude CPU 0
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    REQUIRE(0 == ::sched_getaffinity(0, sizeof(allowed), &allowed));
+    int cpu = 0;
+    while (cpu < CPU_SETSIZE && !CPU_ISSET(cpu, &allowed)) ++cpu;
+    REQUIRE(cpu < CPU_SETSIZE);
+
+    engine_options options;
+    options.cpu_affinity = {cpu};
+    options.numa_local_memory = true;
+    std::atomic<int> nb_misplaced{0};
+    boson::run(2, options, [&]() {
+      for (thread_id id = 0; id < 2; ++id) {
+        start_explicit(id, [&]() {
+          if (::sched_getcpu() != cpu) ++nb_misplaced;
+        });
+      }
+    });
+    CHECK(nb_misplaced == 0);
+  }
+
+  SECTION("Invalid CPU") {
+    engine_options options;
+    options.cpu_affinity = {-1};
+    CHECK_THROWS_AS(boson::run(1, options, []() {}), boson::exception const&);
+  }
+}
+
+namespace {
+void record_steps(std::mutex& lock, std::string& steps, char name, int nb_steps) {
+  for (int index = 0; index < nb_steps; ++index) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      steps.push_back(name);
+    }
+    boson::yield();
+  }
+}
+}
+
+TEST_CASE("Engine - Scheduling policies", "[engine][scheduling]") {
+  boson::debug::logger_instance(&std::cout);
+
+  engine_options options;
+  options.default_placement = placement::local;
+  std::mutex lock;
+  std::string steps;
+
+  start_options critical;
+  critical.priority = priority_class::critical;
+  start_options background;
+  background.priority = priority_class::background;
+
+  SECTION("Strict priority") {
+    options.scheduling_policy = scheduling::priority;
+    boson::run(1, options, [&]() {
+      start(background, record_steps, std::ref(lock), std::ref(steps), 'b', 3);
+      start(critical, record_steps, std::ref(lock), std::ref(steps), 'c', 3);
+    });
+    CHECK(steps == "cccbbb");
+  }
+
+  SECTION("Starvation protection") {
+    options.scheduling_policy = scheduling::priority;
+    options.starvation_limit = 2;
+    boson::run(1, options, [&]() {
+      start(background, record_steps, std::ref(lock), std::ref(steps), 'b', 2);
+      start(critical, record_steps, std::ref(lock), std::ref(steps), 'c', 6);
+    });
+    CHECK(steps == "cccbcccb");
+  }
+
+  SECTION("Earliest deadline first") {
+    options.scheduling_policy = scheduling::earliest_deadline;
+    start_options late;
+    late.deadline = std::chrono::steady_clock::now() + 2s;
+    start_options soon;
+    soon.deadline = std::chrono::steady_clock::now() + 1s;
+    boson::run(1, options, [&]() {
+      start(record_steps, std::ref(lock), std::ref(steps), 'n', 2);
+      start(late, record_steps, std::ref(lock), std::ref(steps), 'l', 2);
+      start(soon, record_steps, std::ref(lock), std::ref(steps), 's', 2);
+    });
+    CHECK(steps == "slnsln");
+  }
+}
+
+TEST_CASE("Engine - Maybe yield", "[engine][yield]") {
+  boson::debug::logger_instance(&std::cout);
+
+  engine_options options;
+  options.yield_quantum = 100us;
+  options.default_placement = placement::local;
+
+  SECTION("Alone") {
+    int nb_yields = 0;
+    boson::run(1, options, [&]() {
+      auto deadline = std::chrono::steady_clock::now() + 5ms;
+      while (std::chrono::steady_clock::now() < deadline) {
+        if (boson::maybe_yield()) ++nb_yields;
+      }
+    });
+    CHECK(nb_yields == 0);
+  }
+
+  SECTION("Sharing the thread") {
+    std::atomic<bool> slept{false};
+    bool timed_out = false;
+    int nb_yields = 0;
+    boson::run(1, options, [&]() {
+      start([&]() {
+        boson::sleep(1ms);
+        slept = true;
+      });
+      auto deadline = std::chrono::steady_clock::now() + 2s;
+      while (!slept && !(timed_out = deadline < std::chrono::steady_clock::now())) {
+        if (boson::maybe_yield()) ++nb_yields;
+      }
+    });
+    CHECK(slept);
+    CHECK_FALSE(timed_out);
+    CHECK(0 < nb_yields);
+  }
+
+  SECTION("Routines waiting for I/O") {
+    int pipe_fds[2];
+    REQUIRE(0 == ::pipe2(pipe_fds, O_NONBLOCK));
+    std::atomic<bool> received{false};
+    bool timed_out = false;
+    int nb_idle_yields = 0;
+    int nb_ready_yields = 0;
+    boson::run(1, options, [&]() {
+      start([&]() {
+        char buffer = 0;
+        received = 1 == boson::read(pipe_fds[0], &buffer, 1);
+      });
+      boson::yield();
+      auto deadline = std::chrono::steady_clock::now() + 5ms;
+      while (std::chrono::steady_clock::now() < deadline) {
+        if (boson::maybe_yield()) ++nb_idle_yields;
+      }
+      ::write(pipe_fds[1], "x", 1);
+      deadline = std::chrono::steady_clock::now() + 2s;
+      while (!received && !(timed_out = deadline < std::chrono::steady_clock::now())) {
+        if (boson::maybe_yield()) ++nb_ready_yields;
+      }
+    });
+    ::close(pipe_fds[0]);
+    ::close(pipe_fds[1]);
+    CHECK(nb_idle_yields == 0);
+    CHECK(received);
+    CHECK_FALSE(timed_out);
+    CHECK(0 < nb_ready_yields);
+  }
+}
+
+TEST_CASE("Engine - Migration", "[engine][migration]") {
+  boson::debug::logger_instance(&std::cout);
+
+  int pipe_fds[2];
+  REQUIRE(0 == ::pipe2(pipe_fds, O_NONBLOCK));
+
+  std::atomic<bool> refused{false};
+  std::atomic<int> nb_misplaced{0};
+  std::atomic<int> nb_read{0};
+  boson::run(3, [&]() {
+    start_explicit(0, [&]() {
+      refused = !boson::migrate_to(3);
+      // Times out and leaves a stale registration in thread 0
+      boson::wait_read_readiness(pipe_fds[0], 1);
+      for (thread_id target : {1, 2}) {
+        boson::migrate_to(target);
+        if (internal::current_thread()->id() != target) ++nb_misplaced;
+      }
+      start_explicit(0, [&]() { ::write(pipe_fds[1], "x", 1); });
+      char buffer = 0;
+      nb_read = boson::read(pipe_fds[0], &buffer, 1);
+      for (int index = 0; index < 10; ++index) {
+        boson::yield();
+        if (internal::current_thread()->id() != 2) ++nb_misplaced;
+      }
+    });
+  });
+  ::close(pipe_fds[0]);
+  ::close(pipe_fds[1]);
+
+  CHECK(refused);
+  CHECK(nb_misplaced == 0);
+  CHECK(nb_read == 1);
+}
+
+TEST_CASE("Engine - Spinning idle threads", "[engine][spin]") {
+  boson::debug::logger_instance(&std::cout);
+
+  engine_options options;
+  SECTION("Spin before park") {
+    options.spin_before_park = 200us;
+  }
+  SECTION("Busy poll") {
+    options.busy_poll = true;
+  }
+
+  // Ping pong keeps one thread idle while the other works
+  std::atomic<int> sum{0};
+  std::atomic<bool> slept{false};
+  boson::run(2, options, [&]() {
+    channel<int, 1> pings;
+    channel<int, 1> pongs;
+    start_explicit(1, [&](channel<int, 1> input, channel<int, 1> output) {
+      int value = 0;
+      while (input >> value) output << value;
+      output.close();
+    }, pings, pongs);
+    start_explicit(0, [&](channel<int, 1> output, channel<int, 1> input) {
+      for (int index = 1; index <= 1000; ++index) {
+        int value = 0;
+        output << index;
+        input >> value;
+        sum += value;
+      }
+      output.close();
+      // Timers still fire while spinning
+      boson::sleep(1ms);
+      slept = true;
+    }, pings, pongs);
+  });
+  CHECK(sum == 500500);
+  CHECK(slept);
+}
+
+TEST_CASE("Engine - Elastic threads", "[engine][elastic]") {
+  boson::debug::logger_instance(&std::cout);
+
+  engine_options options;
+  options.elastic = true;
+  options.elastic_start_threshold = 2;
+
+  SECTION("Lazy start") {
+    size_t nb_started = 0;
+    std::atomic<int> nb_done{0};
+    boson::run(64, options, [&]() {
+      for (int index = 0; index < 2; ++index) start([&]() { ++nb_done; });
+      boson::sleep(1ms);
+      nb_started = internal::current_thread()->get_engine().nb_started_threads();
+    });
+    CHECK(nb_done == 2);
+    CHECK(nb_started == 1);
+  }
+
+  SECTION("Explicit start") {
+    std::atomic<bool> misplaced{true};
+    boson::run(64, options, [&]() {
+      start_explicit(40, [&]() { misplaced = internal::current_thread()->id() != 40; });
+    });
+    CHECK_FALSE(misplaced);
+  }
+
+  SECTION("Growth under load") {
+    size_t nb_started = 0;
+    boson::run(8, options, [&]() {
+      std::atomic<int> nb_done{0};
+      for (int index = 0; index < 32; ++index) {
+        start([&]() {
+          for (int step = 0; step < 10; ++step) boson::yield();
+          ++nb_done;
+        });
+      }
+      while (nb_done < 32) boson::sleep(1ms);
+      nb_started = internal::current_thread()->get_engine().nb_started_threads();
+    });
+    CHECK(1 < nb_started);
+  }
+
+  SECTION("Parking") {
+    options.park_after = 1ms;
+    std::atomic<thread_id> ran_on{64};
+    boson::run(2, options, [&]() {
+      start_explicit(1, []() {});
+      boson::sleep(20ms);
+      // Thread 1 is parked, the routine stays with us
+      start([&]() { ran_on = internal::current_thread()->id(); });
+    });
+    CHECK(ran_on == 0);
+  }
+}
+
+TEST_CASE("Engine - Stack cache", "[engine][stack]") {
+  boson::debug::logger_instance(&std::cout);
+
+  engine_options options;
+  options.stack_cache_size = 4;
+  options.stack_cache_high_water_mark = 2;
+  stack_cache_stats stats{};
+
+  SECTION("Reuse") {
+    boson::run(1, options, [&]() {
+      std::atomic<int> nb_done{0};
+      for (int index = 0; index < 100; ++index) start([&]() { ++nb_done; });
+      while (nb_done < 100) boson::yield();
+      stats = boson::stack_stats();
+    });
+    // The first routine and ourselves had to map a stack
+    CHECK(stats.nb_misses == 2);
+    CHECK(stats.nb_hits == 99);
+  }
+
+  SECTION("Trimming") {
+    boson::run(1, options, [&]() {
+      std::atomic<int> nb_started{0};
+      std::atomic<int> nb_done{0};
+      for (int index = 0; index < 8; ++index) {
+        start([&]() {
+          // Every stack is in use at once
+          ++nb_started;
+          while (nb_started < 8) boson::yield();
+          ++nb_done;
+        });
+      }
+      while (nb_done < 8) boson::yield();
+      boson::yield();
+      stats = boson::stack_stats();
+    });
+    CHECK(stats.nb_misses == 9);
+    CHECK(stats.nb_cached == 4);
+    CHECK(stats.nb_trimmed == 2);
+  }
+}
+
+namespace {
+// Touches about depth KiB of stack
+int recurse(int depth) {
+  volatile char frame[1024];
+  frame[0] = 1;
+  return 0 < depth ? recurse(depth - 1) + frame[0] : frame[0];
+}
+}
+
+TEST_CASE("Engine - Stack classes", "[engine][stack]") {
+  boson::debug::logger_instance(&std::cout);
+
+  engine_options options;
+  options.stack_cache_size = 4;
+  stack_cache_stats stats{};
+
+  SECTION("Per class pools") {
+    start_options large;
+    large.stack = stack_class::large;
+    start_options tiny;
+    tiny.stack = stack_class::tiny;
+    int result = -1;
+    boson::run(1, options, [&]() {
+      std::atomic<int> nb_done{0};
+      // Would overflow the default stack
+      start(large, [&]() {
+        result = recurse(256);
+        ++nb_done;
+      });
+      start(tiny, [&]() { ++nb_done; });
+      while (nb_done < 2) boson::yield();
+      boson::yield();
+      // Each class reuses its own stacks
+      start(large, [&]() { ++nb_done; });
+      start(tiny, [&]() { ++nb_done; });
+      while (nb_done < 4) boson::yield();
+      stats = boson::stack_stats();
+    });
+    CHECK(result == 257);
+    CHECK(stats.nb_misses == 3);
+    CHECK(stats.nb_hits == 2);
+  }
+}
+
+namespace {
+struct deep_function {
+  std::atomic<int>& nb_done;
+  void operator()() {
+    recurse(16);
+    ++nb_done;
+  }
+};
+
+struct shallow_function {
+  std::atomic<int>& nb_done;
+  void operator()() {
+    ++nb_done;
+  }
+};
+}
+
+TEST_CASE("Engine - Stack profiling", "[engine][stack]") {
+  boson::debug::logger_instance(&std::cout);
+
+  engine_options options;
+  options.stack_cache_size = 4;
+
+  SECTION("Usage per function type") {
+    options.stack_profiling = true;
+    stack_usage_profile profile;
+    boson::run(1, options, [&]() {
+      std::atomic<int> nb_done{0};
+      start_options medium;
+      medium.stack = stack_class::medium;
+      for (int index = 0; index < 3; ++index) start(medium, deep_function{nb_done});
+      start(shallow_function{nb_done});
+      while (nb_done < 4) boson::yield();
+      boson::yield();
+      profile = boson::stack_profile();
+    });
+    auto const& deep = profile.at(typeid(deep_function));
+    CHECK(deep.nb_samples == 3);
+    CHECK(16 * 1024 < deep.max_used);
+    CHECK(deep.suggested_class == stack_class::medium);
+    auto const& shallow = profile.at(typeid(shallow_function));
+    CHECK(shallow.nb_samples == 1);
+    CHECK(0 < shallow.max_used);
+    CHECK(shallow.suggested_class == stack_class::tiny);
+  }
+
+  SECTION("Automatic sizing") {
+    options.auto_stack_sizing = true;
+    options.stack_sizing_samples = 2;
+    auto run_shallow = [&options]() {
+      stack_cache_stats stats{};
+      boson::run(1, options, [&]() {
+        std::atomic<int> nb_done{0};
+        for (int index = 0; index < 4; ++index) {
+          // One at a time, so that stacks are reused
+          start(shallow_function{nb_done});
+          while (nb_done < index + 1) boson::yield();
+          boson::yield();
+        }
+        stats = boson::stack_stats();
+      });
+      return stats;
+    };
+
+    // Two small stacks are sampled, then guarded tiny ones are used
+    options.stack_guards = {{true, false, true, true}};
+    stack_cache_stats stats = run_shallow();
+    CHECK(stats.nb_misses == 3);
+    CHECK(stats.nb_hits == 2);
+
+    // Tiny stacks are unguarded by default, so the small ones are kept
+    options.stack_guards = engine_options{}.stack_guards;
+    stats = run_shallow();
+    CHECK(stats.nb_misses == 2);
+    CHECK(stats.nb_hits == 3);
+  }
+}
+
+namespace {
+// Tells if this thread may count the event, as the engine threads do
+bool can_count(uint32_t type, uint64_t config) {
+  perf_event_attr attributes;
+  std::memset(&attributes, 0, sizeof(attributes));
+  attributes.size = sizeof(attributes);
+  attributes.type = type;
+  attributes.config = config;
+  attributes.exclude_kernel = 1;
+  attributes.exclude_hv = 1;
+  int fd = static_cast<int>(::syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+  if (fd < 0) return false;
+  ::close(fd);
+  return true;
+}
+
+// Tells if [begin, end) lies in a single mapping of this process
+bool is_one_mapping(std::uintptr_t begin, std::uintptr_t end) {
+  std::ifstream maps{"/proc/self/maps"};
+  std::string line;
+  while (std::getline(maps, line)) {
+    std::uintptr_t first = 0, last = 0;
+    if (2 != std::sscanf(line.c_str(), "%" SCNxPTR "-%" SCNxPTR, &first, &last)) continue;
+    if (first <= begin && begin < last) return end <= last;
+  }
+  return false;
+}
+}
+
+TEST_CASE("Engine - Stack backing", "[engine][stack]") {
+  boson::debug::logger_instance(&std::cout);
+
+  engine_options options;
+  std::atomic<int> nb_done{0};
+
+  SECTION("Prefaulting") {
+    auto sctx = internal::allocate(stack_class::medium, false);
+    CHECK(internal::prefault_stack(sctx.sp, 16 * 1024, false));
+    std::size_t page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    std::vector<unsigned char> residency(sctx.size / page_size);
+    REQUIRE(0 == ::mincore(static_cast<char*>(sctx.sp) - sctx.size, sctx.size, residency.data()));
+    CHECK((residency.back() & 1));
+    CHECK((residency[residency.size() - 16 * 1024 / page_size] & 1));
+    CHECK(!(residency.front() & 1));
+    internal::deallocate(sctx);
+  }
+
+  SECTION("Huge page arenas") {
+    options.stack_backing = stack_memory::huge_pages;
+    options.stack_cache_size = 16;
+    {
+      // Stacks are carved one after the other from an arena aligned on its size.
+      // Medium stacks are guarded by default, but a guard would split the arena.
+      constexpr std::uintptr_t arena_size = 2 * 1024 * 1024;
+      internal::stack_cache cache{options};
+      auto first = cache.get(stack_class::medium);
+      auto second = cache.get(stack_class::medium);
+      CHECK(first.guard_size == 0);
+      CHECK(second.guard_size == 0);
+      auto first_base = reinterpret_cast<std::uintptr_t>(first.sp) - first.size;
+      auto second_base = reinterpret_cast<std::uintptr_t>(second.sp) - second.size;
+      CHECK(0 == first_base % arena_size);
+      CHECK(second_base == reinterpret_cast<std::uintptr_t>(first.sp));
+      CHECK((reinterpret_cast<std::uintptr_t>(second.sp) - 1) / arena_size ==
+            first_base / arena_size);
+      CHECK(is_one_mapping(first_base, first_base + arena_size));
+      cache.put(first);
+      cache.put(second);
+      CHECK(is_one_mapping(first_base, first_base + arena_size));
+    }
+
+    options.stack_prefault_size = 4096;
+    options.stack_lock = true;
+    options.stack_fault_counters = true;
+    stack_cache_stats stats{};
+    boson::run(1, options, [&]() {
+      start_options medium;
+      medium.stack = stack_class::medium;
+      for (int index = 0; index < 100; ++index) {
+        start(medium, [&]() {
+          recurse(32);
+          ++nb_done;
+        });
+        start([&]() { ++nb_done; });
+      }
+      while (nb_done < 200) boson::yield();
+      stats = boson::stack_stats();
+    });
+    CHECK(nb_done == 200);
+    // Finished routines give their stack back to the cache, not to the arena
+    CHECK(stats.nb_misses + stats.nb_hits == 201);
+    CHECK(stats.nb_misses < 10);
+    // Counters are only checked where perf lets us open them
+    if (can_count(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS))
+      CHECK(0 < stats.nb_page_faults);
+    else
+      WARN("Page fault counter unavailable, not checked");
+    if (can_count(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)))
+      CHECK(0 < stats.nb_dtlb_misses);
+    else
+      WARN("dTLB miss counter unavailable, not checked");
+  }
+}
+
+TEST_CASE("Engine - Shared stacks", "[engine][stack]") {
+  boson::debug::logger_instance(&std::cout);
+
+  engine_options options;
+  std::atomic<int> nb_done{0};
+  std::atomic<int> nb_corrupted{0};
+  start_options shared;
+  shared.shared_stack = true;
+
+  SECTION("Frames survive switches") {
+    boson::run(1, options, [&]() {
+      for (int index = 0; index < 1000; ++index) {
+        start(shared, [&, index]() {
+          int frame[64];
+          for (auto& value : frame) value = index;
+          for (int round = 0; round < 3; ++round) {
+            boson::yield();
+            boson::sleep(std::chrono::milliseconds(1));
+            for (auto value : frame)
+              if (value != index) ++nb_corrupted;
+          }
+          ++nb_done;
+        });
+      }
+      // Regular routines run in between
+      start([&]() {
+        boson::yield();
+        ++nb_done;
+      });
+    });
+    CHECK(nb_done == 1001);
+    CHECK(nb_corrupted == 0);
+  }
+
+  SECTION("No migration") {
+    bool migrated = true;
+    boson::run(2, options, [&]() {
+      start(shared,
+            [&]() { migrated = boson::migrate_to(1 - internal::current_thread()->id()); });
+    });
+    CHECK(!migrated);
+  }
+}
@@ -0,0 +1,107 @@
+#include "catch.hpp"
+#include "boson/boson.h"
+#include "boson/parallel.h"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "boson/logger.h"
+
+using namespace boson;
+using namespace std::literals;
+
+namespace {
+/**
+ * Records the threads processing chunks
+ *
+ * The first chunk waits a bit for another thread to join, so that a loop
+ * run by the caller alone is told apart even on a single core.
+ */
+struct participants {
+  std::atomic<bool> seen[3] = {{false}, {false}, {false}};
+  std::atomic<bool> waited{false};
+
+  size_t count() const {
+    size_t nb_seen = 0;
+    for (auto& thread_seen : seen) nb_seen += thread_seen ? 1 : 0;
+    return nb_seen;
+  }
+
+  void record() {
+    seen[internal::current_thread()->id()] = true;
+    if (waited.exchange(true)) return;
+    auto deadline = std::chrono::steady_clock::now() + 1s;
+    while (count() < 2 && std::chrono::steady_clock::now() < deadline)
+      std::this_thread::yield();
+  }
+};
+}
+
+TEST_CASE("Parallel - Loops", "[parallel]") {
+  boson::debug::logger_instance(&std::cout);
+
+  SECTION("Every index once") {
+    std::vector<std::atomic<int>> hits(10000);
+    participants threads;
+    boson::run(3, [&]() {
+      parallel_for(0, hits.size(), 0, [&](size_t index) {
+        ++hits[index];
+        threads.record();
+      });
+    });
+    int nb_wrong = 0;
+    for (auto& hit : hits) nb_wrong += hit == 1 ? 0 : 1;
+    CHECK(nb_wrong == 0);
+    CHECK(1 < threads.count());
+  }
+
+  SECTION("Reduction") {
+    size_t sum = 0;
+    participants threads;
+    boson::run(3, [&]() {
+      sum = parallel_reduce(
+          1, 100001, 100, size_t{0},
+          [&threads](size_t first, size_t last, size_t partial) {
+            threads.record();
+            for (size_t index = first; index < last; ++index) partial += index;
+            return partial;
+          },
+          [](size_t left, size_t right) { return left + right; });
+    });
+    CHECK(sum == size_t{100000} * 100001 / 2);
+    CHECK(1 < threads.count());
+  }
+
+  SECTION("Caller is suspended") {
+    // A single thread, the loop only runs if the caller lets it
+    bool done = false;
+    size_t nb_indexes = 0;
+    size_t nb_indexes_at_first_tick = 1;
+    boson::run(1, [&]() {
+      start(placement::local, [&]() {
+        nb_indexes_at_first_tick = nb_indexes;
+        while (!done) boson::yield();
+      });
+      parallel_for(0, 1000, 10, [&](size_t) { ++nb_indexes; });
+      done = true;
+    });
+    CHECK(nb_indexes == 1000);
+    CHECK(nb_indexes_at_first_tick == 0);
+  }
+
+  SECTION("Exceptions") {
+    bool caught = false;
+    boson::run(2, [&]() {
+      try {
+        parallel_for(0, 1000, 1, [](size_t index) {
+          if (index == 500) throw std::runtime_error("failure");
+        });
+      } catch (std::runtime_error const&) {
+        caught = true;
+      }
+    });
+    CHECK(caught);
+  }
+}
@@ -0,0 +1,29 @@
+/**
+ * Measures the yield rate of routines sharing a thread
+ *
+ * Every yield sends the routine back to the run queue, so this is
+ * mostly the cost of a context switch and of the queue itself.
+ */
+#include <chrono>
+#include <iostream>
+#include "boson/boson.h"
+
+static constexpr size_t nb_routines = 100;
+static constexpr size_t nb_yields = 1e5;
+
+int main(void) {
+  using namespace std::chrono;
+  auto start = steady_clock::now();
+  boson::run(1, []() {
+    for (size_t index = 0; index < nb_routines; ++index) {
+      boson::start([]() {
+        for (size_t yield_index = 0; yield_index < nb_yields; ++yield_index)
+          boson::yield();
+      });
+    }
+  });
+  auto elapsed = duration_cast<duration<double>>(steady_clock::now() - start).count();
+  std::cout << static_cast<size_t>(nb_routines * nb_yields / elapsed) << " yields/s"
+            << std::endl;
+  return 0;
+}
@@ -124,3 +124,21 @@ TEST_CASE("Vectorized queue - Queue with suppressed elements", "[queues][vectori
 
   CHECK(expected_values == read_values);
 }
+
+TEST_CASE("Vectorized queue - Read within a window", "[queues][vectorized_queue]") {
+  boson::queues::vectorized_queue<size_t> instance;
+  for (size_t index = 0; index < 6; ++index) instance.write(index);
+
+  size_t read_value = 0;
+  auto is_odd = [](size_t value) { return value % 2 == 1; };
+  CHECK(instance.read_within(read_value, 3, is_odd) == 1);
+  CHECK(read_value == 1);
+  // Remaining: 0 2 3 4 5, nothing matches in the first two
+  CHECK(instance.read_within(read_value, 2, is_odd) == 2);
+  CHECK(instance.read_within(read_value, 3, is_odd) == 2);
+  CHECK(read_value == 3);
+
+  std::vector<size_t> read_values;
+  while (instance.read(read_value)) read_values.push_back(read_value);
+  CHECK(read_values == (std::vector<size_t>{0, 2, 4, 5}));
+}
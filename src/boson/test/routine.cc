@@ -43,3 +43,35 @@ TEST_CASE("Routines - Panic", "[routines][panic]") {
 
   CHECK(return_code == boson::code_panic);
 }
+
+TEST_CASE("Routines - Run queue", "[routines][run_queue]") {
+  using internal::routine;
+  internal::run_queue queue;
+  auto now = std::chrono::steady_clock::now();
+  int deadlines[] = {3, 1, 2, 1, 3, 0};
+  for (size_t index = 0; index < 6; ++index) {
+    start_options options;
+    options.deadline = now + std::chrono::seconds(deadlines[index]);
+    auto new_routine = new routine(index, []() {});
+    new_routine->set_schedule(options);
+    queue.push_back(new_routine);
+  }
+
+  queue.stable_sort([](routine const& left, routine const& right) {
+    return left.schedule().deadline < right.schedule().deadline;
+  });
+  std::vector<routine_id> ids;
+  internal::run_queue other;
+  while (!queue.empty()) {
+    ids.push_back(queue.front()->id());
+    other.push_back(queue.pop_front());
+  }
+  CHECK(ids == (std::vector<routine_id>{5, 1, 3, 2, 0, 4}));
+  CHECK(other.size() == 6);
+
+  queue.push_back(new routine(6, []() {}));
+  queue.splice_front(other);
+  CHECK(queue.size() == 7);
+  CHECK(other.empty());
+  CHECK(queue.front()->id() == 5);
+}
@@ -91,3 +91,30 @@ TEST_CASE("Semaphore - Disabling", "[semaphore]") {
     });
   }
 }
+
+TEST_CASE("Semaphore - Same thread wake ups", "[semaphore]") {
+  boson::debug::logger_instance(&std::cout);
+
+  size_t nb_wakeups_before = 0;
+  size_t nb_wakeups_after = 0;
+  boson::run(1, [&]() {
+    shared_semaphore ping(0);
+    shared_semaphore pong(0);
+    nb_wakeups_before = internal::current_thread()->nb_wakeups_sent();
+
+    start(placement::local, [](auto ping, auto pong) -> void {
+      for (int index = 0; index < 100; ++index) {
+        ping.wait();
+        pong.post();
+      }
+    }, ping, pong);
+
+    for (int index = 0; index < 100; ++index) {
+      ping.post();
+      pong.wait();
+    }
+    nb_wakeups_after = internal::current_thread()->nb_wakeups_sent();
+  });
+  // Waiters of the posting thread never go through the eventfd
+  CHECK(nb_wakeups_before == nb_wakeups_after);
+}
@@ -0,0 +1,150 @@
+#include "catch.hpp"
+#include "boson/boson.h"
+#include "boson/task.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+#include <string>
+
+#if defined(BOSON_USE_COROUTINES)
+
+using namespace boson;
+using namespace std::literals;
+
+namespace {
+task<int> add(int left, int right) {
+  co_await co::yield();
+  co_return left + right;
+}
+
+task<> append_after(std::string& steps, char step, std::chrono::milliseconds delay) {
+  co_await co::sleep(delay);
+  steps += step;
+}
+
+task<> read_into(int fd, std::string& received) {
+  char buffer[4];
+  ssize_t nb_bytes = co_await co::read(fd, buffer, sizeof(buffer));
+  if (0 < nb_bytes) received.assign(buffer, nb_bytes);
+  ::close(fd);
+}
+
+task<> sum(std::atomic<int>& result) {
+  int first = co_await add(1, 2);
+  int second = co_await add(first, 3);
+  result = second;
+}
+}
+
+TEST_CASE("Tasks - Awaiting", "[task]") {
+  SECTION("Nested tasks") {
+    std::atomic<int> result{0};
+    boson::run(1, [&]() { start_task(sum(result)); });
+    CHECK(result == 6);
+  }
+
+  SECTION("Sleep") {
+    std::string steps;
+    boson::run(1, [&]() {
+      start_task(append_after(steps, 'b', 20ms));
+      start_task(append_after(steps, 'a', 5ms));
+    });
+    CHECK(steps == "ab");
+  }
+
+  SECTION("Exceptions") {
+    bool caught = false;
+    boson::run(1, [&]() {
+      // Captureless, the closure is gone before the task runs
+      start_task([](bool& caught) -> task<> {
+        try {
+          co_await []() -> task<> {
+            co_await co::yield();
+            throw std::runtime_error("failure");
+          }();
+        } catch (std::runtime_error const&) {
+          caught = true;
+        }
+      }(caught));
+    });
+    CHECK(caught);
+  }
+}
+
+TEST_CASE("Tasks - Interoperability", "[task]") {
+  SECTION("Pipes") {
+    std::string received;
+    boson::run(1, [&]() {
+      int pipe_fds[2];
+      ::pipe2(pipe_fds, O_NONBLOCK);
+      start_task([](int fd, std::string& received) -> task<> {
+        char buffer[4];
+        ssize_t nb_bytes = co_await co::read(fd, buffer, sizeof(buffer));
+        if (0 < nb_bytes) received.assign(buffer, nb_bytes);
+        ::close(fd);
+      }(pipe_fds[0], received));
+      // The writer is a routine, which the task waits for
+      start([pipe_fds]() {
+        boson::sleep(10ms);
+        boson::write(pipe_fds[1], "ping", 4);
+        ::close(pipe_fds[1]);
+      });
+    });
+    CHECK(received == "ping");
+  }
+
+  SECTION("Registration left by a migrating routine") {
+    std::string received;
+    boson::run(2, [&]() {
+      int pipe_fds[2];
+      ::pipe2(pipe_fds, O_NONBLOCK);
+      start_explicit(0, [&received](int read_fd, int write_fd) {
+        // Times out and leaves a stale registration, which the task takes over
+        boson::wait_read_readiness(read_fd, 1);
+        start_task(read_into(read_fd, received));
+        boson::yield();
+        // Leaving must not unregister the task
+        boson::migrate_to(1);
+        boson::sleep(5ms);
+        boson::write(write_fd, "ping", 4);
+        ::close(write_fd);
+      }, pipe_fds[0], pipe_fds[1]);
+    });
+    CHECK(received == "ping");
+  }
+
+  SECTION("Channels") {
+    int total = 0;
+    boson::run(1, [&]() {
+      channel<int, 1> numbers;
+      channel<int, 1> result;
+      start_task([](channel<int, 1> numbers, channel<int, 1> result) -> task<> {
+        int value = 0, sum = 0;
+        while (co_await co::read(numbers, value)) sum += value;
+        co_await co::write(result, sum);
+      }(numbers, result));
+      for (int index = 1; index <= 100; ++index) numbers << index;
+      numbers.close();
+      result >> total;
+    });
+    CHECK(total == 5050);
+  }
+
+  SECTION("Semaphores") {
+    std::atomic<int> nb_done{0};
+    boson::run(1, [&]() {
+      shared_semaphore sema(0);
+      for (int index = 0; index < 10; ++index) {
+        start_task([](shared_semaphore sema, std::atomic<int>& nb_done) -> task<> {
+          if (co_await co::wait(sema)) ++nb_done;
+        }(sema, nb_done));
+      }
+      boson::sleep(5ms);
+      for (int index = 0; index < 10; ++index) sema.post();
+    });
+    CHECK(nb_done == 10);
+  }
+}
+
+#endif  // BOSON_USE_COROUTINES
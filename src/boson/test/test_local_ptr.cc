@@ -14,6 +14,10 @@ struct A {
     instances(1);
   }
 
+  A(A const&) {
+    instances(1);
+  }
+
   ~A() {
     instances(-1);
   }
@@ -54,3 +58,24 @@ TEST_CASE("Local pointer","[local_ptr]") {
     a3 = a1;
   }
 }
+
+TEST_CASE("Local pointer - Reuse","[local_ptr]") {
+  CHECK(A::instances() == 0);
+  {
+    local_ptr<A> a1(A{});
+    CHECK(A::instances() == 1);
+    CHECK(a1.unique());
+    local_ptr<A> a2 = a1;
+    CHECK_FALSE(a1.unique());
+    a2.invalidate_all();
+    a2 = nullptr;
+    CHECK(A::instances() == 0);
+
+    CHECK(a1.unique());
+    CHECK(!a1);
+    a1.emplace(A{});
+    CHECK(a1);
+    CHECK(A::instances() == 1);
+  }
+  CHECK(A::instances() == 0);
+}
@@ -36,9 +36,9 @@ struct listen_client {
 
 void broadcast_message(std::set<int> const& connections, std::string const& data) {
   std::shared_ptr<std::string> shared_data { new std::string(data) };
-  for (auto dest : connections) {
-    boson::start([dest,shared_data]() { boson::send(dest, shared_data->c_str(), shared_data->size(), 0); });
-  }
+  boson::start_batch(connections, [shared_data](int dest) {
+    boson::send(dest, shared_data->c_str(), shared_data->size(), 0);
+  });
 }
 
 int main(int argc, char *argv[]) {